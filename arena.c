@@ -0,0 +1,553 @@
+#define _GNU_SOURCE // for sched_getcpu
+#include <stdio.h>
+#include <stdint.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "arena.h"
+#include "log.h"
+#include "stats.h"
+#include "profile.h"
+
+// set in the pending count of an arena by a release that found it pinned: the last
+// thread to unpin it tries the release again
+#define ARENA_RELEASE_WAITING (1 << 30)
+
+static pthread_mutex_t arenas_lock = PTHREAD_MUTEX_INITIALIZER; // protects the list and the homes
+static Arena* arenas; // list of all the arenas
+static int num_arenas;
+static ArenaPolicy policy = ARENA_PER_CPU;
+static ArenaBacking backing = ARENA_PAGES;
+
+// memory for the next arenas: the rest of a huge page, or a released arena of reserved huge
+// pages. The link is at the start of the memory (arenas_lock)
+typedef struct SpareMemory {
+    struct SpareMemory* next;
+    ArenaBacking backing;
+} SpareMemory;
+static SpareMemory* spares;
+
+static Arena* cpu_arenas[ARENA_MAX_CPUS];
+static __thread Arena* thread_arena;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t exit_key; // to release the arena of a thread when it exits
+
+static pthread_mutex_t purger_lock = PTHREAD_MUTEX_INITIALIZER; // protects the purger state
+static pthread_cond_t purger_cond = PTHREAD_COND_INITIALIZER;  // wakes the purger to stop it
+static pthread_t purger;
+static int purger_running;
+static int purger_decay_ms;
+
+// maps size bytes aligned to their size
+static char* Arena_mapAligned(size_t size){
+    // map twice the size to find an aligned region inside, then unmap the rest
+    char* region = mmap(NULL, 2 * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED){
+        LOG_ERROR("Arena error: mmap failed with error: %s\n", strerror(errno));
+        return NULL;
+    }
+    char* base = (char*)(((uintptr_t)region + size - 1) & ~(uintptr_t)(size - 1));
+    if (base > region) munmap(region, base - region);
+    if (base + size < region + 2 * size) munmap(base + size, region + size - base);
+    return base;
+}
+
+static void Arena_addSpare(char* memory, ArenaBacking memory_backing){
+    SpareMemory* spare = (SpareMemory*)memory;
+    spare->backing = memory_backing;
+    spare->next = spares;
+    spares = spare;
+}
+
+// transparent huge pages are not disabled in the kernel
+static int Arena_thpAvailable(void){
+    static int available = -1;
+    if (available < 0){
+        char mode[64] = "";
+        int fd = open("/sys/kernel/mm/transparent_hugepage/enabled", O_RDONLY);
+        if (fd >= 0){
+            if (read(fd, mode, sizeof(mode) - 1) < 0) mode[0] = 0;
+            close(fd);
+        }
+        available = mode[0] && !strstr(mode, "[never]");
+    }
+    return available;
+}
+
+// maps a huge page for HUGE_PAGE_SIZE / ARENA_SIZE arenas: returns the first one, the
+// others are spares. NULL if the huge pages are not available
+static char* Arena_mapHuge(ArenaBacking* got){
+    char* region = NULL;
+#ifdef MAP_HUGETLB
+    if (backing == ARENA_HUGETLB){ // huge page mappings are aligned to the huge page size
+        region = mmap(NULL, HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (region == MAP_FAILED){
+            LOG_INFO("Arena: no reserved huge pages (%s), trying transparent huge pages\n", strerror(errno));
+            region = NULL;
+        } else {
+            *got = ARENA_HUGETLB;
+        }
+    }
+#endif
+#ifdef MADV_HUGEPAGE
+    if (!region && Arena_thpAvailable()){
+        region = Arena_mapAligned(HUGE_PAGE_SIZE);
+        if (region && madvise(region, HUGE_PAGE_SIZE, MADV_HUGEPAGE) != 0){
+            LOG_INFO("Arena: transparent huge pages not supported (%s)\n", strerror(errno));
+            munmap(region, HUGE_PAGE_SIZE);
+            region = NULL;
+        } else if (region){
+            *got = ARENA_THP;
+        }
+    }
+#endif
+    if (!region) return NULL;
+    for (char* spare = region + HUGE_PAGE_SIZE - ARENA_SIZE; spare > region; spare -= ARENA_SIZE){
+        Arena_addSpare(spare, *got);
+    }
+    return region;
+}
+
+// mmaps a new arena aligned to ARENA_SIZE and reserves its first block for the metadata
+// (arenas_lock held by the caller)
+static Arena* Arena_create(void){
+    ArenaBacking got = ARENA_PAGES;
+    char* base = NULL;
+    if (spares){
+        base = (char*)spares;
+        got = spares->backing;
+        spares = spares->next;
+    }
+    if (!base && backing != ARENA_PAGES) base = Arena_mapHuge(&got);
+    if (!base) base = Arena_mapAligned(ARENA_SIZE);
+    if (!base) return NULL;
+
+    // the metadata is the user part of the first block: it starts after the block header
+    Arena* arena = Arena_of(base + sizeof(BuddyHeader));
+    char* bitmap_buffer = (char*)(arena + 1);
+    int bitmap_size = BitMap_getBytes((1 << (ARENA_LEVELS + 1)) - 1);
+    if (BuddyAllocator_init(&arena->buddy, ARENA_LEVELS, base, ARENA_SIZE, bitmap_buffer, bitmap_size, ARENA_SIZE >> ARENA_LEVELS) != 0){
+        munmap(base, ARENA_SIZE);
+        return NULL;
+    }
+    if (got != ARENA_PAGES) BuddyAllocator_setPageSize(&arena->buddy, HUGE_PAGE_SIZE);
+    // the arena is empty: its first free block is the leftmost one, where the metadata already is
+    int meta_size = sizeof(Arena) + bitmap_size;
+    void* meta = BuddyAllocator_getBuddy(&arena->buddy, BuddyAllocator_level(&arena->buddy, meta_size + sizeof(BuddyHeader)), meta_size);
+    if (meta != (void*)arena){
+        LOG_ERROR("Arena error: metadata block not at the start of the arena\n");
+        munmap(base, ARENA_SIZE);
+        return NULL;
+    }
+    pthread_mutex_init(&arena->lock, NULL);
+    arena->remote_frees = NULL;
+    arena->live = 0;
+    arena->threads = 0;
+    arena->pending = 0;
+    arena->last_dirty = 0;
+    arena->backing = got;
+    arena->next = arenas;
+    arenas = arena;
+    num_arenas++;
+    return arena;
+}
+
+// unmaps an arena if nobody uses it any more
+static void Arena_release(Arena* arena){
+    pthread_mutex_lock(&arenas_lock);
+    // two threads can see the arena empty: only the first one finds it still in the list
+    Arena** a = &arenas;
+    while (*a && *a != arena) a = &(*a)->next;
+    if (*a){
+        pthread_mutex_lock(&arena->lock);
+        int empty = arena->live == 0 && arena->threads == 0;
+        // a thread still pushing a remote free holds it: that thread releases it when done
+        if (empty && (__atomic_fetch_or(&arena->pending, ARENA_RELEASE_WAITING, __ATOMIC_SEQ_CST) & ~ARENA_RELEASE_WAITING)){
+            empty = 0;
+        }
+        pthread_mutex_unlock(&arena->lock);
+        if (empty){
+            *a = arena->next;
+            num_arenas--;
+            int meta_level = levelIdx(((BuddyHeader*)arena - 1)->idx); // the metadata block goes with the arena
+            Stats_buddyFree(meta_level, ARENA_SIZE >> meta_level);
+            Stats_purge(-(long long)arena->buddy.dirty_bytes, -(long long)arena->buddy.purged_bytes);
+            pthread_mutex_destroy(&arena->lock);
+            if (arena->backing == ARENA_HUGETLB){ // unmapped by whole huge pages only: kept for the next arenas
+                Arena_addSpare(arena->buddy.memory, ARENA_HUGETLB);
+            } else {
+                munmap(arena->buddy.memory, ARENA_SIZE);
+            }
+        }
+    }
+    pthread_mutex_unlock(&arenas_lock);
+}
+
+// gives the blocks of the remote frees back to the buddy allocator, in batches (arena lock held)
+static void Arena_drainRemote(Arena* arena){
+    void* block = __atomic_exchange_n(&arena->remote_frees, NULL, __ATOMIC_SEQ_CST);
+    void* batch[BUDDY_BATCH_SIZE];
+    int count = 0;
+    while (block){
+        void* next = *(void**)block;
+        if (BuddyAllocator_bit(&arena->buddy, ((BuddyHeader*)block - 1)->idx)) arena->live--; // not busy on a double free
+        batch[count++] = block;
+        if (count == BUDDY_BATCH_SIZE){
+            BuddyAllocator_freeBatch(&arena->buddy, batch, count);
+            count = 0;
+        }
+        block = next;
+    }
+    if (count) BuddyAllocator_freeBatch(&arena->buddy, batch, count);
+}
+
+static void thread_exit(void* arg){
+    Arena* arena = (Arena*)arg;
+    pthread_mutex_lock(&arena->lock);
+    // seen by the threads pushing remote frees: after this they give the blocks back themselves
+    __atomic_sub_fetch(&arena->threads, 1, __ATOMIC_SEQ_CST);
+    Arena_drainRemote(arena);
+    pthread_mutex_unlock(&arena->lock);
+    Arena_release(arena);
+}
+
+static void create_key(void){
+    pthread_key_create(&exit_key, thread_exit);
+}
+
+// home slot of the calling thread in the per-CPU policy
+static int Arena_cpu(void){
+    int cpu = sched_getcpu();
+    if (cpu < 0) cpu = 0;
+    return cpu % ARENA_MAX_CPUS;
+}
+
+// home arena of the calling thread, NULL if it has none yet
+static Arena* Arena_current(void){
+    if (policy == ARENA_PER_THREAD) return thread_arena;
+    return __atomic_load_n(&cpu_arenas[Arena_cpu()], __ATOMIC_ACQUIRE);
+}
+
+// home arena of the calling thread, created on first use
+static Arena* Arena_home(void){
+    if (policy == ARENA_PER_THREAD){
+        if (!thread_arena){
+            pthread_once(&key_once, create_key);
+            pthread_mutex_lock(&arenas_lock);
+            thread_arena = Arena_create();
+            if (thread_arena) thread_arena->threads = 1;
+            pthread_mutex_unlock(&arenas_lock);
+            if (thread_arena) pthread_setspecific(exit_key, thread_arena);
+        }
+        return thread_arena;
+    }
+    int cpu = Arena_cpu();
+    Arena* arena = __atomic_load_n(&cpu_arenas[cpu], __ATOMIC_ACQUIRE);
+    if (!arena){
+        pthread_mutex_lock(&arenas_lock);
+        arena = cpu_arenas[cpu];
+        if (!arena){
+            arena = Arena_create();
+            if (arena){
+                arena->threads = 1; // CPU homes are never released
+                __atomic_store_n(&cpu_arenas[cpu], arena, __ATOMIC_RELEASE);
+            }
+        }
+        pthread_mutex_unlock(&arenas_lock);
+    }
+    return arena;
+}
+
+// tries to allocate from one arena, taking back its remote frees first
+static void* Arena_tryMalloc(Arena* arena, size_t size, size_t alignment){
+    pthread_mutex_lock(&arena->lock);
+    if (__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED)) Arena_drainRemote(arena);
+    void* p = BuddyAllocator_mallocAligned(&arena->buddy, size, alignment);
+    if (p) arena->live++;
+    pthread_mutex_unlock(&arena->lock);
+    return p;
+}
+
+void Arena_setPolicy(ArenaPolicy new_policy){
+    policy = new_policy;
+}
+
+void Arena_setBacking(ArenaBacking new_backing){
+    pthread_mutex_lock(&arenas_lock);
+    backing = new_backing;
+    pthread_mutex_unlock(&arenas_lock);
+}
+
+int Arena_countBacking(ArenaBacking arena_backing){
+    int count = 0;
+    pthread_mutex_lock(&arenas_lock);
+    for (Arena* arena = arenas; arena; arena = arena->next){
+        if (arena->backing == arena_backing) count++;
+    }
+    pthread_mutex_unlock(&arenas_lock);
+    return count;
+}
+
+// allocates from the home arena, then from the others, then from a new one
+static void* Arena_allocate(size_t size, size_t alignment){
+    Arena* home = Arena_home();
+    if (!home) return NULL;
+    void* p = Arena_tryMalloc(home, size, alignment);
+    if (p) return p;
+
+    // the home arena is full: look in the others, and map a new one if they are all full
+    pthread_mutex_lock(&arenas_lock);
+    for (Arena* arena = arenas; arena && !p; arena = arena->next){
+        if (arena != home) p = Arena_tryMalloc(arena, size, alignment);
+    }
+    if (!p){
+        Arena* arena = Arena_create();
+        if (arena){
+            p = Arena_tryMalloc(arena, size, alignment);
+            if (policy == ARENA_PER_THREAD){ // the thread moves to the new arena
+                arena->threads = 1;
+                thread_arena = arena;
+                pthread_setspecific(exit_key, arena);
+            }
+        }
+    }
+    pthread_mutex_unlock(&arenas_lock);
+    if (p && policy == ARENA_PER_THREAD && thread_arena != home){
+        thread_exit(home); // the old home is released once its blocks are freed
+    }
+    if (!p){
+        LOG_ERROR("Malloc error: no free memory block available\n");
+        Stats_failed();
+    }
+    else PROFILE_ALLOC(p, size);
+    return p;
+}
+
+void* Arena_malloc(size_t size){
+    if (size == 0 || size >= pseudo_malloc_threshold()){ // errors and mmap allocations
+        return pseudo_malloc(NULL, size);
+    }
+    // arenas are aligned to their size: the blocks have the natural alignment of the header
+    return Arena_allocate(size, sizeof(BuddyHeader));
+}
+
+void* Arena_mallocAligned(size_t size, size_t alignment){
+    if (size == 0 || alignment == 0 || (alignment & (alignment - 1))){
+        LOG_ERROR("\nMalloc error: Invalid alignment (%zu) or size (%zu)\n", alignment, size);
+        return NULL;
+    }
+    if (size >= pseudo_malloc_threshold() || alignment >= pseudo_malloc_threshold() - size){ // the padding makes it a large allocation
+        return pseudo_aligned_alloc(NULL, alignment, size);
+    }
+    return Arena_allocate(size, alignment);
+}
+
+void* Arena_realloc(void* ptr, size_t size){
+    if (!ptr){
+        return Arena_malloc(size);
+    }
+    if (size == 0){
+        Arena_free(ptr);
+        return NULL;
+    }
+    size_t old_size;
+    if (pseudo_is_mapped(ptr)){ // mmap block
+        if (size >= pseudo_malloc_threshold()){ // resized in its mapping or moved by mremap
+            return pseudo_realloc(NULL, ptr, size);
+        }
+        old_size = pseudo_usable_size(NULL, ptr);
+    } else {
+        Arena* arena = Arena_of(ptr);
+        void* p = NULL;
+        pthread_mutex_lock(&arena->lock);
+        if (size < pseudo_malloc_threshold()){
+            p = BuddyAllocator_resize(&arena->buddy, ptr, size);
+        }
+        old_size = BuddyAllocator_usableSize(&arena->buddy, ptr);
+        pthread_mutex_unlock(&arena->lock);
+        if (p){
+            PROFILE_FREE(ptr); // sampled again with its new size
+            PROFILE_ALLOC(p, size);
+            return p;
+        }
+    }
+    void* p = Arena_malloc(size);
+    if (!p) return NULL;
+    memcpy(p, ptr, old_size < size ? old_size : size);
+    Arena_free(ptr);
+    return p;
+}
+
+void Arena_free(void* ptr){
+    if (!ptr){
+        LOG_ERROR("\nFree error: Memory to be freed is NULL\n");
+        return;
+    }
+    if (pseudo_is_mapped(ptr)){ // mmap block
+        pseudo_free(NULL, ptr);
+        return;
+    }
+    PROFILE_FREE(ptr);
+    Arena* arena = Arena_of(ptr);
+    if (arena != Arena_current() && __atomic_load_n(&arena->threads, __ATOMIC_SEQ_CST) > 0){
+        // the size in the header marks the blocks on the stack, so a double free cannot push one twice
+        if (__atomic_exchange_n(&((BuddyHeader*)ptr - 1)->size, 0, __ATOMIC_RELAXED) == 0){
+            LOG_ERROR("\nFree error: Memory block at index: %p, already freed (double free).\n", ptr);
+            return;
+        }
+        // once on the stack the block no longer keeps the arena mapped: it is pinned until the push is over
+        __atomic_add_fetch(&arena->pending, 1, __ATOMIC_SEQ_CST);
+        void* head = __atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED);
+        do {
+            *(void**)ptr = head;
+        } while (!__atomic_compare_exchange_n(&arena->remote_frees, &head, ptr, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+        int empty = 0;
+        if (__atomic_load_n(&arena->threads, __ATOMIC_SEQ_CST) == 0){
+            // the last home thread left before seeing the block: nobody else would drain it
+            pthread_mutex_lock(&arena->lock);
+            Arena_drainRemote(arena);
+            empty = arena->live == 0 && arena->threads == 0;
+            pthread_mutex_unlock(&arena->lock);
+        }
+        // after the unpin the arena can be gone: only Arena_release, which looks for it in the list, may touch it
+        if (__atomic_sub_fetch(&arena->pending, 1, __ATOMIC_SEQ_CST) == ARENA_RELEASE_WAITING) empty = 1;
+        if (empty) Arena_release(arena);
+        return;
+    }
+    pthread_mutex_lock(&arena->lock);
+    int busy = BuddyAllocator_bit(&arena->buddy, ((BuddyHeader*)ptr - 1)->idx); // not busy on a double free
+    BuddyAllocator_free(&arena->buddy, ptr);
+    if (busy) arena->live--;
+    int empty = arena->live == 0 && arena->threads == 0;
+    pthread_mutex_unlock(&arena->lock);
+    if (empty) Arena_release(arena);
+}
+
+size_t Arena_usableSize(void* ptr){
+    if (pseudo_is_mapped(ptr)){ // mmap block
+        return pseudo_usable_size(NULL, ptr);
+    }
+    return BuddyAllocator_usableSize(&Arena_of(ptr)->buddy, ptr);
+}
+
+Arena* Arena_of(void* ptr){
+    uintptr_t base = (uintptr_t)ptr & ~(uintptr_t)(ARENA_SIZE - 1);
+    return (Arena*)(base + sizeof(BuddyHeader)); // after the header of the metadata block
+}
+
+int Arena_count(void){
+    pthread_mutex_lock(&arenas_lock);
+    int count = num_arenas;
+    pthread_mutex_unlock(&arenas_lock);
+    return count;
+}
+
+size_t Arena_trim(void){
+    size_t purged = 0;
+    pthread_mutex_lock(&arenas_lock);
+    for (Arena* arena = arenas; arena; arena = arena->next){
+        pthread_mutex_lock(&arena->lock);
+        Arena_drainRemote(arena); // blocks of the home threads that stopped allocating
+        purged += BuddyAllocator_purge(&arena->buddy);
+        arena->last_dirty = arena->buddy.dirty_bytes;
+        pthread_mutex_unlock(&arena->lock);
+    }
+    pthread_mutex_unlock(&arenas_lock);
+    MmapCache_flush();
+    return purged;
+}
+
+// one pass of the purger: an arena is purged when its dirty pages stayed the same since the
+// last pass, as it is not freeing or reusing them any more
+static void Arena_decay(void){
+    pthread_mutex_lock(&arenas_lock);
+    for (Arena* arena = arenas; arena; arena = arena->next){
+        pthread_mutex_lock(&arena->lock);
+        Arena_drainRemote(arena);
+        if (arena->buddy.dirty_bytes && arena->buddy.dirty_bytes == arena->last_dirty){
+            BuddyAllocator_purge(&arena->buddy);
+        }
+        arena->last_dirty = arena->buddy.dirty_bytes;
+        pthread_mutex_unlock(&arena->lock);
+    }
+    pthread_mutex_unlock(&arenas_lock);
+}
+
+static void* Arena_purger(void* arg){
+    pthread_mutex_lock(&purger_lock);
+    while (purger_running){
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += purger_decay_ms / 1000;
+        until.tv_nsec += (purger_decay_ms % 1000) * 1000000L;
+        if (until.tv_nsec >= 1000000000L){
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        if (pthread_cond_timedwait(&purger_cond, &purger_lock, &until) == ETIMEDOUT && purger_running){
+            pthread_mutex_unlock(&purger_lock);
+            Arena_decay();
+            pthread_mutex_lock(&purger_lock);
+        }
+    }
+    pthread_mutex_unlock(&purger_lock);
+    return NULL;
+}
+
+int Arena_startPurger(int decay_ms){
+    if (decay_ms <= 0){
+        LOG_ERROR("Arena error: invalid purge period (%d ms)\n", decay_ms);
+        return -1;
+    }
+    pthread_mutex_lock(&purger_lock);
+    if (purger_running){
+        pthread_mutex_unlock(&purger_lock);
+        LOG_ERROR("Arena error: the purger is running already\n");
+        return -1;
+    }
+    purger_decay_ms = decay_ms;
+    purger_running = 1;
+    int error = pthread_create(&purger, NULL, Arena_purger, NULL);
+    if (error){
+        purger_running = 0;
+        LOG_ERROR("Arena error: cannot start the purger: %s\n", strerror(error));
+    }
+    pthread_mutex_unlock(&purger_lock);
+    return error ? -1 : 0;
+}
+
+void Arena_stopPurger(void){
+    pthread_mutex_lock(&purger_lock);
+    int running = purger_running;
+    purger_running = 0;
+    pthread_cond_signal(&purger_cond);
+    pthread_mutex_unlock(&purger_lock);
+    if (running) pthread_join(purger, NULL);
+}
+
+void Arena_lockAll(void){
+    pthread_mutex_lock(&purger_lock); // the purger takes the arenas without it
+    pthread_mutex_lock(&arenas_lock);
+    for (Arena* arena = arenas; arena; arena = arena->next){
+        pthread_mutex_lock(&arena->lock);
+    }
+}
+
+void Arena_unlockAll(void){
+    for (Arena* arena = arenas; arena; arena = arena->next){
+        pthread_mutex_unlock(&arena->lock);
+    }
+    pthread_mutex_unlock(&arenas_lock);
+    pthread_mutex_unlock(&purger_lock);
+}
+
+void Arena_forkChild(void){
+    purger_running = 0;
+    pthread_cond_init(&purger_cond, NULL); // it may have had the purger as a waiter
+    Arena_unlockAll();
+}
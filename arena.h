@@ -0,0 +1,92 @@
+#pragma once
+#include <pthread.h>
+#include "pseudo_malloc.h"
+
+#define ARENA_SIZE (1024*1024)  // bytes managed by each arena, arenas are aligned to their size
+#define ARENA_LEVELS 16         // minimum bucket of 16 bytes
+#define ARENA_MAX_CPUS 64       // homes of the per-CPU policy (CPUs beyond share them)
+
+// pages backing the memory of the arenas. A huge page holds HUGE_PAGE_SIZE / ARENA_SIZE
+// arenas: they are mapped together and the next arenas take the rest of the huge page.
+// When a backing is not available the next one is used: reserved huge pages, transparent
+// huge pages, regular pages. The free pages of huge arenas are not purged (that would
+// split the huge pages), the reserved ones are reused by the next arenas instead of unmapped
+typedef enum {
+    ARENA_PAGES,   // regular pages (default)
+    ARENA_THP,     // transparent huge pages (madvise MADV_HUGEPAGE)
+    ARENA_HUGETLB  // huge pages reserved by the administrator (mmap MAP_HUGETLB)
+} ArenaBacking;
+
+// Arena manager on top of BuddyAllocator: buddy arenas are mmapped on demand
+// when the existing ones are full, and given back to the OS once they are empty.
+// Every arena is aligned to ARENA_SIZE and keeps its metadata (this struct and the
+// bitmap) in the first block of its own memory, so the arena owning a pointer is
+// found by masking the address.
+// A block freed by a thread whose home is another arena does not take the lock: it is
+// pushed on the remote_frees stack of its arena (linked through the first bytes of the
+// blocks, lock-free: many threads push, the holder of the lock takes the whole stack),
+// and the home threads give the stack back to the buddy allocator in a batch at their
+// next allocation. Producer/consumer threads then never compete for a lock.
+typedef struct Arena {
+    BuddyAllocator buddy;
+    pthread_mutex_t lock;  // protects buddy, live and threads
+    struct Arena* next;    // list of all the arenas
+    void* remote_frees;    // blocks freed by the threads of other arenas, not given back yet
+    int live;              // blocks currently allocated from the arena (the remote frees included)
+    int threads;           // threads (or CPUs) using it as their home arena
+    int pending;           // threads pushing a remote free, the arena stays mapped until they are done
+    size_t last_dirty;     // dirty bytes of the buddy seen by the last pass of the purger
+    ArenaBacking backing;  // what the memory actually got
+} Arena;
+
+// how the threads are assigned a home arena, where they allocate first
+typedef enum {
+    ARENA_PER_CPU,    // one arena for each CPU, chosen on every allocation (default)
+    ARENA_PER_THREAD  // one arena for each thread, released when the thread exits
+} ArenaPolicy;
+
+// to be called before the first allocation
+void Arena_setPolicy(ArenaPolicy policy);
+
+// backing of the arenas created from now on
+void Arena_setBacking(ArenaBacking backing);
+
+// number of arenas currently mapped with the given backing
+int Arena_countBacking(ArenaBacking backing);
+
+void* Arena_malloc(size_t size);
+
+// frees a block: a block of another arena than the home of the thread goes on its remote_frees
+void Arena_free(void* ptr);
+
+// allocates size bytes aligned to alignment (a power of 2)
+void* Arena_mallocAligned(size_t size, size_t alignment);
+
+// resizes a block in place when possible, otherwise moves it
+void* Arena_realloc(void* ptr, size_t size);
+
+// bytes that the user can use in a block
+size_t Arena_usableSize(void* ptr);
+
+// arena owning a block returned by Arena_malloc (small allocations only), in O(1)
+Arena* Arena_of(void* ptr);
+
+// number of arenas currently mapped
+int Arena_count(void);
+
+// gives the free pages of all the arenas and the mmap cache back to the OS, returns the
+// bytes purged from the arenas
+size_t Arena_trim(void);
+
+// starts a thread that every decay_ms purges the arenas whose dirty pages did not change
+// for a whole period, so the memory freed after a load spike goes back to the OS once the
+// spike is over. Returns 0 on success, -1 if it is running already or cannot start
+int Arena_startPurger(int decay_ms);
+void Arena_stopPurger(void);
+
+// take and release all the locks of the arenas and of the purger, to fork in a consistent state.
+// In the child Arena_forkChild releases them instead: the purger thread did not survive the fork,
+// the child can start its own
+void Arena_lockAll(void);
+void Arena_unlockAll(void);
+void Arena_forkChild(void);
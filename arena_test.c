@@ -0,0 +1,323 @@
+#include "arena.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define NUM_BLOCKS 3000 // 1 KB blocks: about 3 arenas
+#define NUM_THREADS 4
+
+typedef struct {
+    int total_tests;
+    int passed_tests;
+} TestResult;
+
+TestResult test_result = {0, 0};
+
+void print_test_result(bool passed, const char* description) {
+    test_result.total_tests++;
+    if (passed) {
+        test_result.passed_tests++;
+        printf("[SUCCESS] %s\n", description);
+    } else {
+        printf("[ERROR] %s\n", description);
+    }
+}
+
+void test_growth_and_release() {
+    printf("\n== Running arena growth tests ==\n");
+
+    int initial = Arena_count();
+    static void* blocks[NUM_BLOCKS];
+    bool all_allocated = true, owners_found = true;
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        blocks[i] = Arena_malloc(1000);
+        if (!blocks[i]) { all_allocated = false; continue; }
+        memset(blocks[i], 0xAB, 1000);
+        Arena* arena = Arena_of(blocks[i]);
+        if ((char*)blocks[i] < arena->buddy.memory || (char*)blocks[i] + 1000 > arena->buddy.memory + ARENA_SIZE) owners_found = false;
+    }
+    print_test_result(all_allocated, "Allocate more than the memory of one arena");
+    print_test_result(Arena_count() >= 3, "New arenas mapped on demand");
+    print_test_result(owners_found, "Owning arena of every block found from its address");
+
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        Arena_free(blocks[i]);
+    }
+    print_test_result(Arena_count() == (initial ? initial : 1), "Empty arenas given back to the OS, the home arena kept");
+
+    void* large = Arena_malloc(5000);
+    print_test_result(large != NULL, "Allocate 5000 bytes with mmap");
+    Arena_free(large);
+
+    printf("== Arena growth tests completed ==\n");
+}
+
+// resident pages of the arena memory
+int resident_pages(Arena* arena) {
+    int page_size = sysconf(_SC_PAGESIZE);
+    unsigned char vec[ARENA_SIZE / 4096];
+    if (mincore(arena->buddy.memory, ARENA_SIZE, vec) != 0) return -1;
+    int count = 0;
+    for (int i = 0; i < ARENA_SIZE / page_size; i++) count += vec[i] & 1;
+    return count;
+}
+
+void test_purge() {
+    printf("\n== Running purge tests ==\n");
+
+    // fill most of an arena, keeping its first block: the rest is freed in large blocks
+    static void* blocks[900];
+    Arena* arena = NULL;
+    int count = 0;
+    for (int i = 0; i < 900; i++) {
+        blocks[i] = Arena_malloc(1000);
+        if (!blocks[i]) break;
+        if (!arena) arena = Arena_of(blocks[i]);
+        memset(blocks[i], 0xAB, 1000);
+        count++;
+    }
+    int touched = resident_pages(arena);
+    for (int i = 1; i < count; i++) Arena_free(blocks[i]);
+    print_test_result(arena->buddy.dirty_bytes > ARENA_SIZE / 2 && arena->buddy.purged_bytes == 0, "Freed pages of the arena are dirty");
+
+    PseudoMallocStats stats;
+    int purged = Arena_trim();
+    pseudo_malloc_stats(&stats);
+    print_test_result(purged > 0 && arena->buddy.purged_bytes >= purged && stats.purged_bytes >= (uint64_t)purged,
+                      "Trim purges the free pages");
+    print_test_result(resident_pages(arena) < touched / 4, "Resident pages of the arena fall after the trim");
+    print_test_result(Arena_trim() == 0, "Purged pages are not purged again");
+
+    // the purged memory is used again: its pages are not purged any more
+    int purged_before = arena->buddy.purged_bytes;
+    bool reused = true;
+    for (int i = 1; i < count; i++) {
+        blocks[i] = Arena_malloc(1000);
+        if (!blocks[i]) { reused = false; break; }
+        memset(blocks[i], 0xCD, 1000);
+    }
+    print_test_result(reused && arena->buddy.purged_bytes < purged_before / 4, "Purged pages allocated again");
+
+    // the purger gives back the pages once they stay free for a whole period
+    print_test_result(Arena_startPurger(20) == 0 && Arena_startPurger(20) == -1, "Purger started once");
+    for (int i = 0; i < count; i++) Arena_free(blocks[i]);
+    usleep(200 * 1000);
+    print_test_result(arena->buddy.purged_bytes > ARENA_SIZE / 2, "Purger gives back the pages of a quiet arena");
+    Arena_stopPurger();
+
+    printf("== Purge tests completed ==\n");
+}
+
+void test_huge_pages() {
+    printf("\n== Running huge page arena tests ==\n");
+
+    // reserved huge pages first: without them the arenas fall back to THP, then to regular pages
+    Arena_setBacking(ARENA_HUGETLB);
+    static void* blocks[NUM_BLOCKS];
+    bool all_allocated = true;
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        blocks[i] = Arena_malloc(1000);
+        if (!blocks[i]) all_allocated = false;
+        else memset(blocks[i], 0xAB, 1000);
+    }
+    print_test_result(all_allocated, "Allocate several arenas with huge pages requested");
+    int huge = Arena_countBacking(ARENA_HUGETLB) + Arena_countBacking(ARENA_THP);
+    printf("arenas: %d reserved huge pages, %d transparent huge pages, %d regular pages\n",
+           Arena_countBacking(ARENA_HUGETLB), Arena_countBacking(ARENA_THP), Arena_countBacking(ARENA_PAGES));
+    print_test_result(huge + Arena_countBacking(ARENA_PAGES) == Arena_count(), "Every arena reports its backing");
+    print_test_result(huge >= 2 || Arena_countBacking(ARENA_PAGES) == Arena_count(), "New arenas backed by huge pages, or fell back to regular pages");
+
+    // the arenas of a huge page are its halves
+    bool paired = true;
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        Arena* arena = Arena_of(blocks[i]);
+        if (arena->backing != ARENA_PAGES && arena->buddy.page_size != HUGE_PAGE_SIZE) paired = false;
+    }
+    print_test_result(paired, "Huge arenas purge by whole huge pages");
+
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        Arena_free(blocks[i]);
+    }
+    Arena_setBacking(ARENA_PAGES);
+    print_test_result(Arena_count() == 1, "Huge arenas given back once empty");
+
+    printf("== Huge page arena tests completed ==\n");
+}
+
+void* thread_worker(void* arg) {
+    void* blocks[64];
+    bool ok = true;
+    for (int i = 0; i < 64; i++) {
+        blocks[i] = Arena_malloc(100);
+        if (!blocks[i]) ok = false;
+    }
+    // every block of the thread comes from the same arena
+    for (int i = 1; i < 64; i++) {
+        if (blocks[i] && Arena_of(blocks[i]) != Arena_of(blocks[0])) ok = false;
+    }
+    for (int i = 0; i < 64; i++) {
+        Arena_free(blocks[i]);
+    }
+    return (void*)ok;
+}
+
+void test_per_thread_arenas() {
+    printf("\n== Running per thread arena tests ==\n");
+
+    Arena_setPolicy(ARENA_PER_THREAD);
+    int initial = Arena_count();
+    pthread_t threads[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        pthread_create(&threads[i], NULL, thread_worker, NULL);
+    }
+    bool ok = true;
+    for (int i = 0; i < NUM_THREADS; i++) {
+        void* ret;
+        pthread_join(threads[i], &ret);
+        if (!ret) ok = false;
+    }
+    print_test_result(ok, "Every thread allocates from its own arena");
+    print_test_result(Arena_count() == initial, "Arenas of the exited threads given back to the OS");
+
+    printf("== Per thread arena tests completed ==\n");
+}
+
+#define REMOTE_BLOCKS 100
+
+void* remote_blocks[REMOTE_BLOCKS];
+pthread_barrier_t remote_barrier;
+bool remote_drained;
+
+// producer: its blocks are freed by the main thread, it takes them back at its next allocation
+void* producer(void* arg) {
+    for (int i = 0; i < REMOTE_BLOCKS; i++) remote_blocks[i] = Arena_malloc(200);
+    Arena* arena = Arena_of(remote_blocks[0]);
+    pthread_barrier_wait(&remote_barrier); // the main thread frees them
+    pthread_barrier_wait(&remote_barrier);
+    void* p = Arena_malloc(200);
+    remote_drained = Arena_of(p) == arena && arena->remote_frees == NULL && arena->live == 1;
+    Arena_free(p);
+
+    // blocks still in use when the thread exits: their arena goes at the last remote free
+    for (int i = 0; i < REMOTE_BLOCKS; i++) remote_blocks[i] = Arena_malloc(200);
+    return NULL;
+}
+
+void test_remote_frees() {
+    printf("\n== Running remote free tests ==\n");
+
+    Arena_setPolicy(ARENA_PER_THREAD);
+    int initial = Arena_count();
+    pthread_barrier_init(&remote_barrier, NULL, 2);
+    pthread_t thread;
+    pthread_create(&thread, NULL, producer, NULL);
+    pthread_barrier_wait(&remote_barrier);
+    Arena* arena = Arena_of(remote_blocks[0]);
+    for (int i = 0; i < REMOTE_BLOCKS; i++) Arena_free(remote_blocks[i]);
+    Arena_free(remote_blocks[0]); // double free: not pushed twice
+    int pending = 0;
+    for (void* p = arena->remote_frees; p; p = *(void**)p) pending++;
+    print_test_result(pending == REMOTE_BLOCKS && arena->live == REMOTE_BLOCKS, "Blocks of another thread queued without taking its arena");
+    pthread_barrier_wait(&remote_barrier);
+    pthread_join(thread, NULL);
+    print_test_result(remote_drained, "Queued blocks given back by the owner at its next allocation");
+
+    print_test_result(Arena_count() == initial + 1, "Arena of an exited thread kept while its blocks are in use");
+    for (int i = 0; i < REMOTE_BLOCKS; i++) Arena_free(remote_blocks[i]);
+    print_test_result(Arena_count() == initial, "Arena released by the last free of another thread");
+    pthread_barrier_destroy(&remote_barrier);
+
+    printf("== Remote free tests completed ==\n");
+}
+
+#define SHORT_THREADS 64 // owners, NUM_THREADS at a time
+#define HANDOFF_BLOCKS 32
+#define CONSUMERS 3
+
+void* handoff[SHORT_THREADS * HANDOFF_BLOCKS];
+int handoff_count, handoff_freed;
+pthread_mutex_t handoff_lock = PTHREAD_MUTEX_INITIALIZER;
+bool handoff_intact = true;
+
+// short-lived owner: hands its blocks to the consumers and exits while they free them
+void* short_owner(void* arg) {
+    for (int i = 0; i < HANDOFF_BLOCKS; i++) {
+        char* p = Arena_malloc(200);
+        if (!p) continue;
+        memset(p, 0x5A, 200);
+        pthread_mutex_lock(&handoff_lock);
+        handoff[handoff_count++] = p;
+        pthread_mutex_unlock(&handoff_lock);
+    }
+    // exits once the consumers are freeing its blocks
+    for (;;) {
+        pthread_mutex_lock(&handoff_lock);
+        int started = handoff_count < HANDOFF_BLOCKS;
+        pthread_mutex_unlock(&handoff_lock);
+        if (started) return NULL;
+        sched_yield();
+    }
+}
+
+void* consumer(void* arg) {
+    for (;;) {
+        char* p = NULL;
+        pthread_mutex_lock(&handoff_lock);
+        int done = handoff_freed == SHORT_THREADS * HANDOFF_BLOCKS;
+        if (handoff_count) {
+            p = handoff[--handoff_count];
+            handoff_freed++;
+        }
+        pthread_mutex_unlock(&handoff_lock);
+        if (done) return NULL;
+        if (!p) { sched_yield(); continue; }
+        if (p[0] != 0x5A || p[199] != 0x5A) handoff_intact = false;
+        Arena_free(p); // races with the exit of the owner and with the other consumers
+    }
+}
+
+void test_remote_frees_exiting_owners() {
+    printf("\n== Running remote frees with exiting owners tests ==\n");
+
+    Arena_setPolicy(ARENA_PER_THREAD);
+    int initial = Arena_count();
+    pthread_t consumers[CONSUMERS];
+    for (int i = 0; i < CONSUMERS; i++) pthread_create(&consumers[i], NULL, consumer, NULL);
+    for (int i = 0; i < SHORT_THREADS; i += NUM_THREADS) {
+        pthread_t owners[NUM_THREADS];
+        for (int j = 0; j < NUM_THREADS; j++) pthread_create(&owners[j], NULL, short_owner, NULL);
+        for (int j = 0; j < NUM_THREADS; j++) pthread_join(owners[j], NULL);
+    }
+    for (int i = 0; i < CONSUMERS; i++) pthread_join(consumers[i], NULL);
+    print_test_result(handoff_intact, "Blocks of exiting owners intact until freed by the consumers");
+    print_test_result(Arena_count() == initial, "Arenas of the exited owners released after the last remote free");
+
+    printf("== Remote frees with exiting owners tests completed ==\n");
+}
+
+void print_final_results() {
+    printf("\n========== TEST RESULTS ==========\n");
+    printf("Total tests run: %d\n", test_result.total_tests);
+    printf("Passed tests: %d\n", test_result.passed_tests);
+    printf("Failed tests: %d\n", test_result.total_tests - test_result.passed_tests);
+    printf("==================================\n");
+}
+
+int main(int argc, char** argv) {
+    // Run tests
+    test_growth_and_release();
+    test_purge();
+    test_huge_pages();
+    test_per_thread_arenas();
+    test_remote_frees();
+    test_remote_frees_exiting_owners();
+
+    // Print final results
+    print_final_results();
+
+    return 0;
+}
@@ -1,5 +1,25 @@
 #include <assert.h>
+#include <string.h>
 #include "bit_map.h"
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// the range operations read the buffer a 64 bit word at a time: bit i is
+// bit (i & 63) of the word i >> 6 only if the words are little endian
+static inline uint64_t load_word(const uint8_t* p) {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w)); // the buffer has no alignment guarantees
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  w = __builtin_bswap64(w);
+#endif
+  return w;
+}
+
+// mask of the bits [from, to) of a byte, 0 <= from < to <= 8
+static inline uint8_t byte_mask(int from, int to) {
+  return (uint8_t)((0xFF << from) & (0xFF >> (8 - to)));
+}
 
 // returns the number of bytes to store bits booleans
 int BitMap_getBytes(int bits) {
@@ -34,3 +54,184 @@ int BitMap_bit(const BitMap* bit_map, int bit_num) {
   int bit_in_byte = bit_num & 0x07; 
   return (bit_map->buffer[byte_num] & (1 << bit_in_byte)) != 0;
 }
+
+// sets all the bits in [start, end) to status (0 or 1)
+void BitMap_setRange(BitMap* bit_map, int start, int end, int status) {
+  if (start >= end) return;
+  assert(start >= 0 && end <= bit_map->num_bits);
+  int first_byte = start >> 3;
+  int last_byte = (end - 1) >> 3;
+  uint8_t* buffer = bit_map->buffer;
+
+  if (first_byte == last_byte) { // the whole range is inside one byte
+    uint8_t mask = byte_mask(start & 0x07, ((end - 1) & 0x07) + 1);
+    if (status) buffer[first_byte] |= mask;
+    else        buffer[first_byte] &= ~mask;
+    return;
+  }
+  // partial first and last byte, full bytes in between
+  uint8_t head = byte_mask(start & 0x07, 8);
+  uint8_t tail = byte_mask(0, ((end - 1) & 0x07) + 1);
+  if (status) {
+    buffer[first_byte] |= head;
+    buffer[last_byte] |= tail;
+  } else {
+    buffer[first_byte] &= ~head;
+    buffer[last_byte] &= ~tail;
+  }
+  // memset is already vectorized by the C library
+  memset(buffer + first_byte + 1, status ? 0xFF : 0x00, last_byte - first_byte - 1);
+}
+
+// returns the index of the first bit set to 0 in [start, end), -1 if there is none
+int BitMap_findFirstZero(const BitMap* bit_map, int start, int end) {
+  if (start >= end) return -1;
+  assert(start >= 0 && end <= bit_map->num_bits);
+  const uint8_t* buffer = bit_map->buffer;
+  int byte_num = start >> 3;
+  int end_byte = end >> 3; // bytes before end_byte are entirely inside the range
+
+  // first (possibly partial) byte
+  if (start & 0x07) {
+    int to = (byte_num == end_byte) ? (end & 0x07) : 8;
+    uint8_t zeros = (uint8_t)~buffer[byte_num] & byte_mask(start & 0x07, to);
+    if (zeros) return (byte_num << 3) + __builtin_ctz(zeros);
+    byte_num++;
+  }
+
+  // full bytes: skip the ones that are all set, a vector at a time when possible
+#if defined(__AVX2__)
+  const __m256i ones256 = _mm256_set1_epi8((char)0xFF);
+  for (; byte_num + 32 <= end_byte; byte_num += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(buffer + byte_num));
+    unsigned int full = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, ones256));
+    if (full != 0xFFFFFFFFu) {
+      byte_num += __builtin_ctz(~full);
+      return (byte_num << 3) + __builtin_ctz((uint8_t)~buffer[byte_num]);
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i ones128 = _mm_set1_epi8((char)0xFF);
+  for (; byte_num + 16 <= end_byte; byte_num += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(buffer + byte_num));
+    unsigned int full = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, ones128));
+    if (full != 0xFFFFu) {
+      byte_num += __builtin_ctz(~full);
+      return (byte_num << 3) + __builtin_ctz((uint8_t)~buffer[byte_num]);
+    }
+  }
+#endif
+  for (; byte_num + 8 <= end_byte; byte_num += 8) {
+    uint64_t zeros = ~load_word(buffer + byte_num);
+    if (zeros) return (byte_num << 3) + __builtin_ctzll(zeros);
+  }
+  for (; byte_num < end_byte; byte_num++) {
+    uint8_t zeros = (uint8_t)~buffer[byte_num];
+    if (zeros) return (byte_num << 3) + __builtin_ctz(zeros);
+  }
+
+  // last partial byte
+  if ((end & 0x07) && byte_num == end_byte) {
+    uint8_t zeros = (uint8_t)~buffer[byte_num] & byte_mask(0, end & 0x07);
+    if (zeros) return (byte_num << 3) + __builtin_ctz(zeros);
+  }
+  return -1;
+}
+
+#if defined(__AVX2__)
+// number of bits set in a 256 bit vector, summed per 64 bit lane (nibble lookup table)
+static inline __m256i popcount256(__m256i v) {
+  const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0F);
+  __m256i lo = _mm256_and_si256(v, low_mask);
+  __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+  __m256i count = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+  return _mm256_sad_epu8(count, _mm256_setzero_si256());
+}
+#endif
+
+// returns the number of bits set to 1 in [start, end)
+int BitMap_popcount(const BitMap* bit_map, int start, int end) {
+  if (start >= end) return 0;
+  assert(start >= 0 && end <= bit_map->num_bits);
+  const uint8_t* buffer = bit_map->buffer;
+  int byte_num = start >> 3;
+  int end_byte = end >> 3;
+  int count = 0;
+
+  if (start & 0x07) {
+    int to = (byte_num == end_byte) ? (end & 0x07) : 8;
+    count += __builtin_popcount(buffer[byte_num] & byte_mask(start & 0x07, to));
+    byte_num++;
+  }
+
+#if defined(__AVX2__)
+  __m256i acc = _mm256_setzero_si256();
+  for (; byte_num + 32 <= end_byte; byte_num += 32) {
+    acc = _mm256_add_epi64(acc, popcount256(_mm256_loadu_si256((const __m256i*)(buffer + byte_num))));
+  }
+  count += (int)(_mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+                 _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3));
+#endif
+  for (; byte_num + 8 <= end_byte; byte_num += 8) {
+    count += __builtin_popcountll(load_word(buffer + byte_num));
+  }
+  for (; byte_num < end_byte; byte_num++) {
+    count += __builtin_popcount(buffer[byte_num]);
+  }
+
+  if ((end & 0x07) && byte_num == end_byte) {
+    count += __builtin_popcount(buffer[byte_num] & byte_mask(0, end & 0x07));
+  }
+  return count;
+}
+
+// returns the 64 bits from start: bit i of the word is the bit start + i (0 past the end)
+uint64_t BitMap_getWord(const BitMap* bit_map, int start) {
+  assert(start >= 0 && start < bit_map->num_bits);
+  const uint8_t* buffer = bit_map->buffer;
+  int byte_num = start >> 3;
+  int shift = start & 0x07;
+  if (byte_num + 9 <= bit_map->buffer_size) { // a word and the byte after it
+    uint64_t word = load_word(buffer + byte_num) >> shift;
+    return shift ? word | (uint64_t)buffer[byte_num + 8] << (64 - shift) : word;
+  }
+  uint64_t word = 0; // near the end of the buffer: a byte at a time
+  for (int i = 0; i < 9 && byte_num + i < bit_map->buffer_size; i++) {
+    uint64_t byte = buffer[byte_num + i];
+    word |= i ? (8 * i - shift < 64 ? byte << (8 * i - shift) : 0) : byte >> shift;
+  }
+  return word;
+}
+
+// sets to status (0 or 1) the bits start + i for the bits i set in mask,
+// which must be inside the bitmap
+void BitMap_setMask(BitMap* bit_map, int start, uint64_t mask, int status) {
+  if (!mask) return;
+  assert(start >= 0 && start + 63 - __builtin_clzll(mask) < bit_map->num_bits);
+  uint8_t* buffer = bit_map->buffer;
+  int byte_num = start >> 3;
+  int shift = start & 0x07;
+  uint64_t low = mask << shift; // bits in the word at byte_num, the others in the byte after it
+  uint8_t high = shift ? (uint8_t)(mask >> (64 - shift)) : 0;
+  if (byte_num + 8 <= bit_map->buffer_size) {
+    uint64_t word = load_word(buffer + byte_num);
+    word = status ? word | low : word & ~low;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    memcpy(buffer + byte_num, &word, sizeof(word));
+  } else {
+    for (int i = 0; i < 8 && byte_num + i < bit_map->buffer_size; i++) {
+      uint8_t byte = (uint8_t)(low >> (8 * i));
+      if (status) buffer[byte_num + i] |= byte;
+      else        buffer[byte_num + i] &= ~byte;
+    }
+  }
+  if (high) {
+    if (status) buffer[byte_num + 8] |= high;
+    else        buffer[byte_num + 8] &= ~high;
+  }
+}
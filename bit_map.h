@@ -20,3 +20,23 @@ void BitMap_setBit(BitMap* bit_map, int bit_num, int status);
 
 // inspects the status of the bit bit_num
 int BitMap_bit(const BitMap* bit_map, int bit_num);
+
+// sets all the bits in [start, end) to status (0 or 1), a byte at a time
+// in the middle of the range
+void BitMap_setRange(BitMap* bit_map, int start, int end, int status);
+
+// the scans below are for flat bitmaps (the free slots of a slab, consistency checks):
+// the buddy tree writes whole ranges, but reads one bit per level on its walks
+
+// returns the index of the first bit set to 0 in [start, end), -1 if there is none
+int BitMap_findFirstZero(const BitMap* bit_map, int start, int end);
+
+// returns the number of bits set to 1 in [start, end)
+int BitMap_popcount(const BitMap* bit_map, int start, int end);
+
+// returns the 64 bits from start: bit i of the word is the bit start + i (0 past the end)
+uint64_t BitMap_getWord(const BitMap* bit_map, int start);
+
+// sets to status (0 or 1) the bits start + i for the bits i set in mask,
+// which must be inside the bitmap
+void BitMap_setMask(BitMap* bit_map, int start, uint64_t mask, int status);
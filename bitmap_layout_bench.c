@@ -0,0 +1,157 @@
+#include "buddy_allocator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+// Level order against blocked bitmap layout on a large tree: cache lines of the bitmap read
+// by a walk from a leaf to the root, ns per walk (marking a leaf and its ancestors busy, then
+// free) and ns per malloc/free on the same operations (same random sequence, same blocks)
+// with each layout, the best of ROUNDS alternated runs.
+// usage: ./bitmap_layout_bench [levels] [ops]
+// (results go to stderr, run with > /dev/null to hide the allocator log)
+
+#define MIN_BUCKET_SIZE 16
+#define CACHE_LINE 64
+#define LIVE_BLOCKS 4096
+#define ROUNDS 3
+
+BuddyAllocator alloc;
+char* memory;
+char* bitmap_buffer;
+int bitmap_size;
+int levels = 22;
+int ops = 1000000;
+void* live[LIVE_BLOCKS];
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static void setup(BuddyLayout layout) {
+    BuddyAllocator_init(&alloc, levels, memory, (size_t)MIN_BUCKET_SIZE << levels, bitmap_buffer, bitmap_size, MIN_BUCKET_SIZE);
+    BuddyAllocator_setLayout(&alloc, layout);
+    memset(live, 0, sizeof(live));
+}
+
+// average cache lines of the bitmap holding the path of a random leaf to the root
+static double walk_lines(BuddyLayout layout) {
+    setup(layout);
+    unsigned int seed = 1;
+    long total = 0;
+    int samples = 1000;
+    for (int i = 0; i < samples; i++) {
+        int leaf = (1 << levels) - 1 + rand_r(&seed) % (1 << levels);
+        update_parent(&alloc, leaf, 1);
+        uint64_t* words = (uint64_t*)bitmap_buffer; // the mapping is page aligned, its end zeroed
+        for (int word = 0; word * 8 < bitmap_size; word += CACHE_LINE / 8) {
+            for (int w = word; w < word + CACHE_LINE / 8; w++) {
+                if (w * 8 < bitmap_size && words[w]) { total++; break; }
+            }
+        }
+        update_parent(&alloc, leaf, 0);
+    }
+    return (double)total / samples;
+}
+
+// the bitmap alone: the path of a random leaf marked busy and free again
+static void walk(unsigned int seed) {
+    for (int i = 0; i < ops; i++) {
+        int leaf = (1 << levels) - 1 + rand_r(&seed) % (1 << levels);
+        update_parent(&alloc, leaf, 1);
+        update_parent(&alloc, leaf, 0);
+    }
+}
+
+// blocks of random sizes replaced at random: the tree stays dense
+static void churn(unsigned int seed) {
+    for (int i = 0; i < ops; i++) {
+        int slot = rand_r(&seed) % LIVE_BLOCKS;
+        if (live[slot]) BuddyAllocator_free(&alloc, live[slot]);
+        live[slot] = BuddyAllocator_malloc(&alloc, 1 + rand_r(&seed) % 2048);
+    }
+}
+
+// few small blocks spread over the whole memory: every allocation splits a large block
+// and every free merges up to it, walking most of the levels
+static void sparse(unsigned int seed) {
+    size_t stride = ((size_t)MIN_BUCKET_SIZE << levels) / LIVE_BLOCKS;
+    for (int slot = 0; slot < LIVE_BLOCKS; slot++) {
+        live[slot] = BuddyAllocator_mallocAligned(&alloc, 16, stride); // one block per stride
+    }
+    for (int i = 0; i < ops; i++) {
+        int slot = rand_r(&seed) % LIVE_BLOCKS;
+        BuddyAllocator_free(&alloc, live[slot]);
+        live[slot] = BuddyAllocator_malloc(&alloc, 16);
+    }
+}
+
+// the whole memory in blocks of 32 bytes, freed in random order
+static void drain(unsigned int seed) {
+    int n = 1 << (levels - 1);
+    if (n > ops) n = ops;
+    void** blocks = malloc(n * sizeof(void*));
+    for (int i = 0; i < n; i++) blocks[i] = BuddyAllocator_malloc(&alloc, 16);
+    for (int i = n - 1; i > 0; i--) {
+        int j = rand_r(&seed) % (i + 1);
+        void* tmp = blocks[i];
+        blocks[i] = blocks[j];
+        blocks[j] = tmp;
+    }
+    for (int i = 0; i < n; i++) BuddyAllocator_free(&alloc, blocks[i]);
+    free(blocks);
+}
+
+// ns per operation of a workload with the given layout
+static double run(void (*workload)(unsigned int), BuddyLayout layout, int operations) {
+    setup(layout);
+    double start = now();
+    workload(42);
+    return (now() - start) / operations;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) levels = atoi(argv[1]);
+    if (argc > 2) ops = atoi(argv[2]);
+    if (levels < 12 || levels >= MAX_LEVELS || ops <= 0) {
+        fprintf(stderr, "usage: %s [levels (12-%d)] [ops]\n", argv[0], MAX_LEVELS - 1);
+        return -1;
+    }
+    size_t memory_size = (size_t)MIN_BUCKET_SIZE << levels;
+    bitmap_size = BitMap_getBytes((1 << (levels + 1)) - 1);
+    memory = mmap(NULL, memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    bitmap_buffer = mmap(NULL, bitmap_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED || bitmap_buffer == MAP_FAILED) {
+        fprintf(stderr, "Cannot map %zu bytes of memory\n", memory_size);
+        return -1;
+    }
+
+    fprintf(stderr, "%d levels, %zu MB of memory, %d KB of bitmap\n", levels, memory_size >> 20, bitmap_size >> 10);
+    fprintf(stderr, "%-24s %12s %12s %8s\n", "", "levels", "blocked", "ratio");
+    double lines = walk_lines(BUDDY_LAYOUT_LEVELS), blocked_lines = walk_lines(BUDDY_LAYOUT_BLOCKED);
+    fprintf(stderr, "%-24s %12.1f %12.1f %7.2fx\n", "lines leaf to root", lines, blocked_lines, lines / blocked_lines);
+
+    struct { const char* name; void (*workload)(unsigned int); int operations; } workloads[] = {
+        {"walk (ns/op)", walk, 2 * ops},
+        {"churn (ns/op)", churn, ops},
+        {"sparse (ns/op)", sparse, ops},
+        {"drain (ns/op)", drain, 2 * (ops < (1 << (levels - 1)) ? ops : 1 << (levels - 1))},
+    };
+    for (int i = 0; i < 4; i++) {
+        run(workloads[i].workload, BUDDY_LAYOUT_LEVELS, 1); // fault the pages in
+        double level_order = 0, blocked = 0;
+        for (int round = 0; round < ROUNDS; round++) {
+            double t = run(workloads[i].workload, BUDDY_LAYOUT_LEVELS, workloads[i].operations);
+            if (!round || t < level_order) level_order = t;
+            t = run(workloads[i].workload, BUDDY_LAYOUT_BLOCKED, workloads[i].operations);
+            if (!round || t < blocked) blocked = t;
+        }
+        fprintf(stderr, "%-24s %12.1f %12.1f %7.2fx\n", workloads[i].name, level_order, blocked, level_order / blocked);
+    }
+    munmap(bitmap_buffer, bitmap_size);
+    munmap(memory, memory_size);
+    return 0;
+}
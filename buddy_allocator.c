@@ -1,24 +1,31 @@
 #include <stdio.h>
 #include <assert.h>
-#include <math.h> // for floor and log2
+#include <stdlib.h> // for qsort
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h> // for sysconf
+#include <sys/mman.h> // for madvise
 #include "buddy_allocator.h"
+#include "log.h"
+#include "stats.h"
 
 ///////////////////////////////////////////////////////////
 // these are trivial helpers to support you in case you want
 // to do a bitmap implementation
 
-// level of node i
+// level of node i: floor(log2(idx + 1))
 int levelIdx(size_t idx){
-  return (int)floor(log2(idx+1));
+  return 63 - __builtin_clzll(idx + 1);
 };
 
 // index of the buddy of node i
 int buddyIdx(int idx){
   if (idx == 0) // root
     return 0;
-  if (idx % 2) // if odd
-    return idx - 1;
-  return idx + 1; // if even
+  if (idx % 2) // if odd (left child)
+    return idx + 1;
+  return idx - 1; // if even (right child)
 }
 
 // parent of the node idx
@@ -37,48 +44,190 @@ int startIdx(int idx){
 }
 ///////////////////////////////////////////////////////////
 
+// levels of the subtrees of the band whose roots are on level top: the last band may be shorter
+static int bandHeight(BuddyAllocator* alloc, int top){
+  int height = alloc->num_levels + 1 - top;
+  return height < BUDDY_BLOCK_LEVELS ? height : BUDDY_BLOCK_LEVELS;
+}
+
+// position in the bitmap of the subtree of node idx, and in local the index of the node in it
+// (the position of its bit is their sum). In the blocked layout the bands start where their
+// first level starts in level order (a band of full subtrees has as many nodes as the levels
+// above it, plus one), then come the subtrees of the band from left to right, and in a subtree
+// its nodes in level order. The level order layout is a single subtree: the parent of a node
+// is always at parentIdx(local) in its subtree, unless local is 0
+static int subtreeBase(BuddyAllocator* alloc, int idx, int* local){
+  if (alloc->layout == BUDDY_LAYOUT_LEVELS){
+    *local = idx;
+    return 0;
+  }
+  int level = levelIdx(idx);
+  int top = level - level % BUDDY_BLOCK_LEVELS; // level of the roots of the subtrees of the band
+  int depth = level - top;
+  int offset = idx - firstIdx(level);
+  *local = firstIdx(depth) + (offset & ((1 << depth) - 1));
+  return firstIdx(top) + (offset >> depth) * ((1 << bandHeight(alloc, top)) - 1);
+}
+
+static int bitPos(BuddyAllocator* alloc, int idx){
+  int local;
+  int base = subtreeBase(alloc, idx, &local);
+  return base + local;
+}
+
+int BuddyAllocator_bit(BuddyAllocator* alloc, int idx){
+  return BitMap_bit(&alloc->bitmap, bitPos(alloc, idx));
+}
+
+static void setBit(BuddyAllocator* alloc, int idx, int value){
+  BitMap_setBit(&alloc->bitmap, bitPos(alloc, idx), value);
+}
+
+// bytes of the blocks of a level
+static size_t blockSize(BuddyAllocator* alloc, int level){
+  return alloc->min_bucket_size << (alloc->num_levels - level);
+}
+
+// address of the block of the bitmap index idx, at the given level
+static char* blockAddress(BuddyAllocator* alloc, int idx, int level){
+  return alloc->memory + (size_t)(idx - firstIdx(level)) * blockSize(alloc, level);
+}
+
+// pages of a free block that a purge can give back: the ones after its link
+// (the length is returned, 0 for blocks smaller than 2 pages)
+static size_t purgeRange(BuddyAllocator* alloc, int idx, int level, char** start){
+  size_t block_size = blockSize(alloc, level);
+  if (block_size < 2 * alloc->page_size) return 0;
+  char* block = blockAddress(alloc, idx, level);
+  uintptr_t mask = alloc->page_size - 1;
+  char* first = (char*)(((uintptr_t)block + sizeof(BuddyListItem) + mask) & ~mask);
+  char* end = (char*)(((uintptr_t)block + block_size) & ~mask);
+  if (start) *start = first;
+  return end > first ? end - first : 0;
+}
+
+static void markPurged(BuddyAllocator* alloc, int idx, int level, size_t range){
+  ((BuddyListItem*)blockAddress(alloc, idx, level))->purged = 1;
+  alloc->dirty_bytes -= range;
+  alloc->purged_bytes += range;
+  Stats_purge(-(long long)range, range);
+}
+
+// insert a free block at the head of the list of its level: its pages count as dirty
+static void freeList_push(BuddyAllocator* alloc, int idx, int level){
+  BuddyListItem* item = (BuddyListItem*)blockAddress(alloc, idx, level);
+  int head = alloc->free_list[level];
+  item->next = head;
+  item->prev = -1;
+  item->purged = 0;
+  if (head != -1)
+    ((BuddyListItem*)blockAddress(alloc, head, level))->prev = idx;
+  alloc->free_list[level] = idx;
+  size_t range = purgeRange(alloc, idx, level, NULL);
+  if (range){
+    alloc->dirty_bytes += range;
+    Stats_purge(range, 0);
+  }
+}
+
+// inserts the right half of a split block: if the parent was purged its pages still are,
+// except the link page written now
+static void freeList_pushHalf(BuddyAllocator* alloc, int idx, int level, int purged){
+  freeList_push(alloc, idx, level);
+  size_t range = purged ? purgeRange(alloc, idx, level, NULL) : 0;
+  if (range) markPurged(alloc, idx, level, range);
+}
+
+// detach a free block from the list of its level, returns 1 if its pages were purged
+static int freeList_remove(BuddyAllocator* alloc, int idx, int level){
+  BuddyListItem* item = (BuddyListItem*)blockAddress(alloc, idx, level);
+  if (item->prev != -1)
+    ((BuddyListItem*)blockAddress(alloc, item->prev, level))->next = item->next;
+  else
+    alloc->free_list[level] = item->next;
+  if (item->next != -1)
+    ((BuddyListItem*)blockAddress(alloc, item->next, level))->prev = item->prev;
+  size_t range = purgeRange(alloc, idx, level, NULL);
+  if (!range) return 0;
+  int purged = item->purged;
+  if (purged){
+    alloc->purged_bytes -= range;
+    Stats_purge(0, -(long long)range);
+  } else {
+    alloc->dirty_bytes -= range;
+    Stats_purge(-(long long)range, 0);
+  }
+  return purged;
+}
+
+// bytes in front of the user pointer: the header, none in headerless mode
+static size_t overhead(BuddyAllocator* alloc){
+  return alloc->order ? 0 : sizeof(BuddyHeader);
+}
+
+static BuddyHeader* header(void* mem){
+  return (BuddyHeader*)mem - 1;
+}
+
+// bitmap index of a headerless block from its offset, at the given level (-1 to read it from the order table)
+static int headerlessIdx(BuddyAllocator* alloc, void* mem, int level){
+  if ((char*)mem < alloc->memory || (char*)mem >= alloc->memory + alloc->memory_size) return -1;
+  size_t offset = (char*)mem - alloc->memory;
+  if (level < 0) level = alloc->order[offset / alloc->min_bucket_size] - 1;
+  if (level < 0) return -1; // no block allocated here
+  size_t block_size = blockSize(alloc, level);
+  if (offset % block_size) return -1; // not the start of a block
+  return firstIdx(level) + offset / block_size;
+}
+
+// bitmap index of an allocated block from its user pointer (-1 if not valid)
+static int blockIdx(BuddyAllocator* alloc, void* mem){
+  if (alloc->order) return headerlessIdx(alloc, mem, -1);
+  return header(mem)->idx;
+}
+
 int BuddyAllocator_init(BuddyAllocator* alloc,
                          int num_levels,
                          char* memory,
-                         int memory_size,
+                         size_t memory_size,
                          char* bitmap_buffer,
                          int bitmap_buffer_size,
-                         int min_bucket_size){
+                         size_t min_bucket_size){
                         
     // buffer checks
     if (!memory){
-      printf("Error: Memory pointer provided is NULL\n");
+      LOG_ERROR("Error: Memory pointer provided is NULL\n");
       return -1;
     } 
     if (!bitmap_buffer){
-      printf("Error: Bitmap buffer pointer provided is NULL\n");
+      LOG_ERROR("Error: Bitmap buffer pointer provided is NULL\n");
       return -1;
     }       
 
     // size checks
-    if (memory_size <= 0){
-      printf("Error: Memory size must be > 0\n");
+    if (memory_size == 0){
+      LOG_ERROR("Error: Memory size must be > 0\n");
       return -1;
     } 
     if (bitmap_buffer_size <= 0){
-      printf("Error: Bitmap buffer size must be > 0\n");
+      LOG_ERROR("Error: Bitmap buffer size must be > 0\n");
       return -1;
     }              
 
     // level checks
-    if (num_levels >= MAX_LEVELS){
-      printf("Error: Number of levels exceeds the maximum (%d)\n", MAX_LEVELS);
+    if (num_levels < 0 || num_levels >= MAX_LEVELS){
+      LOG_ERROR("Error: Number of levels exceeds the maximum (%d)\n", MAX_LEVELS);
       return -1;
     }
 
     // consistency check of min_bucket_size with memory size and number of levels
-    if (min_bucket_size != memory_size >> num_levels){
-      printf("Error: Invalid min_bucket_size\n");
+    if (min_bucket_size == 0 || min_bucket_size != memory_size >> num_levels){
+      LOG_ERROR("Error: Invalid min_bucket_size\n");
       return -1;
     }
 
     // if the memory is not a power of 2, the largest possible portion of available memory (which is a power of 2) will be used
-    if (log2(memory_size) != floor(log2(memory_size))){
+    if (memory_size & (memory_size - 1)){
         memory_size = min_bucket_size << num_levels;
     }
 
@@ -90,165 +239,663 @@ int BuddyAllocator_init(BuddyAllocator* alloc,
     // check the size of the bitmap and available memory to allocate it
     int num_bits = (1 << (num_levels + 1)) - 1; // number of bits will be (2 * 2^num_levels ) - 1 because level 0 is always counted
     if (bitmap_buffer_size < BitMap_getBytes(num_bits)){
-      printf("Error: Insufficient memory provided for Bitmap: requires %d bytes\n", BitMap_getBytes(num_bits));
+      LOG_ERROR("Error: Insufficient memory provided for Bitmap: requires %d bytes\n", BitMap_getBytes(num_bits));
       return -1;
     }
-    // initialization
+    // initialization: all the bits to 0, the buffer may not be zeroed
     BitMap_init(&(alloc->bitmap), num_bits, (uint8_t*)bitmap_buffer);
-    printf("Buddy Allocator Created\nLevels: %d\nMemory Size: %d\nNumber of bits in the bitmap: %d\nBitmap size: %d\nMinimum Bucket Size: %d\n", num_levels, memory_size, num_bits, BitMap_getBytes(num_bits), min_bucket_size);
+    BitMap_setRange(&alloc->bitmap, 0, num_bits, 0);
+    alloc->layout = BUDDY_LAYOUT_LEVELS;
+    // at the beginning the only free block is the whole memory (the root)
+    for (int i = 0; i < MAX_LEVELS; i++){
+      alloc->free_list[i] = -1;
+      alloc->deferred[i] = -1;
+      alloc->num_deferred[i] = 0;
+    }
+    alloc->page_size = sysconf(_SC_PAGESIZE);
+    alloc->used_bytes = 0;
+    alloc->dirty_bytes = 0;
+    alloc->purged_bytes = 0;
+    freeList_push(alloc, 0, 0);
+    alloc->order = NULL;
+    alloc->max_deferred = 0;
+    LOG_INFO("Buddy Allocator Created\nLevels: %d\nMemory Size: %zu\nNumber of bits in the bitmap: %d\nBitmap size: %d\nMinimum Bucket Size: %zu\n", num_levels, memory_size, num_bits, BitMap_getBytes(num_bits), min_bucket_size);
     return 0;
 }
 
-// find a free buddy to return to malloc, also inserting the block index in the bitmap
-// and size in the block to return (for operation)
-void* BuddyAllocator_getBuddy(BuddyAllocator* alloc, int level, int size){
-  int bitmap_idx = -1;
-  if (level == 0){ // root
-    int bit = BitMap_bit(&alloc->bitmap, firstIdx(level));
-    if (bit == 0) bitmap_idx = 0;
-    // if not free, bitmap_idx remains -1, indicating no free blocks found
+int BuddyAllocator_setHeaderless(BuddyAllocator* alloc, uint8_t* order_buffer, int order_buffer_size){
+    if (!order_buffer){
+      LOG_ERROR("Error: Order buffer pointer provided is NULL\n");
+      return -1;
+    }
+    int num_buckets = alloc->memory_size / alloc->min_bucket_size;
+    if (order_buffer_size < num_buckets){
+      LOG_ERROR("Error: Insufficient memory provided for the order table: requires %d bytes\n", num_buckets);
+      return -1;
+    }
+    memset(order_buffer, 0, num_buckets);
+    alloc->order = order_buffer;
+    return 0;
+}
+
+void BuddyAllocator_relocate(BuddyAllocator* alloc, char* memory, char* bitmap_buffer){
+    alloc->memory = memory;
+    alloc->bitmap.buffer = (uint8_t*)bitmap_buffer;
+}
+
+int BuddyAllocator_setPageSize(BuddyAllocator* alloc, size_t page_size){
+    if (page_size == 0 || (page_size & (page_size - 1))){
+      LOG_ERROR("Error: Invalid page size (%zu)\n", page_size);
+      return -1;
+    }
+    if (alloc->free_list[0] != 0){
+      LOG_ERROR("Error: the page size of an allocator in use cannot change\n");
+      return -1;
+    }
+    // the root is counted again with the new pages
+    freeList_remove(alloc, 0, 0);
+    alloc->page_size = page_size;
+    freeList_push(alloc, 0, 0);
+    return 0;
+}
+
+int BuddyAllocator_setLayout(BuddyAllocator* alloc, BuddyLayout layout){
+    if (layout != BUDDY_LAYOUT_LEVELS && layout != BUDDY_LAYOUT_BLOCKED){
+      LOG_ERROR("Error: Invalid bitmap layout (%d)\n", layout);
+      return -1;
+    }
+    if (alloc->free_list[0] != 0){
+      LOG_ERROR("Error: the bitmap layout of an allocator in use cannot change\n");
+      return -1;
+    }
+    alloc->layout = layout; // all the bits are 0 in both layouts
+    return 0;
+}
+
+#define DEFERRED_SIZE 0 // size in the header of a deferred block, never requested
+
+// lazy mode: the link of a deferred block is after its header, which stays in place
+static BuddyListItem* deferredItem(BuddyAllocator* alloc, int idx, int level){
+  return (BuddyListItem*)(blockAddress(alloc, idx, level) + overhead(alloc));
+}
+
+// merges the deferred blocks of a level
+static int coalesceLevel(BuddyAllocator* alloc, int level){
+  int count = alloc->num_deferred[level];
+  while (alloc->deferred[level] != -1){
+    int idx = alloc->deferred[level];
+    alloc->deferred[level] = deferredItem(alloc, idx, level)->next;
+    update_child(alloc, idx, 0);
+    merge(alloc, idx);
   }
-  else{
-    int i = firstIdx(level); // iterate over the entire level to find a buddy
-    while (i < firstIdx(level + 1)){ // until the beginning of the next level
-      int bit = BitMap_bit(&alloc->bitmap, i); 
-      if (bit == 0){
-         bitmap_idx = i; 
-         break;
+  alloc->num_deferred[level] = 0;
+  return count;
+}
+
+int BuddyAllocator_coalesce(BuddyAllocator* alloc){
+  int count = 0;
+  for (int level = alloc->num_levels; level >= 0; level--){ // the deepest first, they merge into the others
+    count += coalesceLevel(alloc, level);
+  }
+  return count;
+}
+
+size_t BuddyAllocator_purge(BuddyAllocator* alloc){
+  size_t purged = 0;
+  for (int level = 0; level <= alloc->num_levels; level++){
+    if (blockSize(alloc, level) < 2 * alloc->page_size) break; // smaller blocks below
+    for (int idx = alloc->free_list[level]; idx != -1; idx = ((BuddyListItem*)blockAddress(alloc, idx, level))->next){
+      char* start;
+      size_t range = purgeRange(alloc, idx, level, &start);
+      if (!range || ((BuddyListItem*)blockAddress(alloc, idx, level))->purged) continue;
+      if (madvise(start, range, MADV_DONTNEED) != 0){
+        LOG_ERROR("Purge error: madvise failed with error: %s\n", strerror(errno));
+        return purged;
       }
-      i++;
+      markPurged(alloc, idx, level, range);
+      purged += range;
     }
   }
-  if (bitmap_idx == -1){ // if no free blocks found
-    return NULL;
+  return purged;
+}
+
+void BuddyAllocator_setLazy(BuddyAllocator* alloc, int max_deferred){
+  alloc->max_deferred = max_deferred > 0 ? max_deferred : 0;
+  for (int level = 0; level <= alloc->num_levels; level++){
+    if (alloc->num_deferred[level] > alloc->max_deferred) coalesceLevel(alloc, level);
   }
-  else{ // block found
-    // update the bitmap setting to 1 the ancestors and children of the taken block
-    update_child(&alloc->bitmap, bitmap_idx, 1); // both functions set the bit indicating the index
-    update_parent(&alloc->bitmap, bitmap_idx, 1); // of the taken block to 1 (being recursive): no need to do it here
+}
 
-    int block_size = alloc->min_bucket_size << (alloc->num_levels - level); // block_size = bucket_size * 2 ^num_level - level
-                                                                            // because levels are counted top-down,
-                                                                            // the size is reversed
+// user pointer of a block just marked busy in the bitmap, writing its header (or its order)
+static void* userPointer(BuddyAllocator* alloc, int bitmap_idx, int level, size_t size){
+  // the address to return is calculated by adding to the start of the memory
+  // the offset of the index in its level * block size
+  char *ret = blockAddress(alloc, bitmap_idx, level);
+  alloc->used_bytes += blockSize(alloc, level);
+  Stats_buddyAlloc(level, blockSize(alloc, level), size);
 
-    char *ret = alloc->memory + ((startIdx(bitmap_idx) + 1) * block_size); // the address to return is calculated by adding to the start
-                                                                          // of the memory the offset of the index in its level * block size
-    
-    // save the bitmap index in the block
-    ((int*)ret)[0] = bitmap_idx;
-    ((int*)ret)[1] = size; // save the size for checking whether to deallocate the block with munmap or free from the buddy allocator
-    return (void *)(ret + 2 * sizeof(int)); // + size of the block address in bitmap and block size (original)
+  if (alloc->order){ // headerless: the level is recorded in the table, the block is all for the user
+    alloc->order[(ret - alloc->memory) / alloc->min_bucket_size] = level + 1;
+    return ret;
   }
+
+  // save the bitmap index in the block
+  BuddyHeader* h = (BuddyHeader*)ret;
+  h->idx = bitmap_idx;
+  h->size = size; // save the size for checking whether to deallocate the block with munmap or free from the buddy allocator
+  return h + 1;
 }
 
-void* BuddyAllocator_malloc(BuddyAllocator* alloc, int size){
+// find a free buddy to return to malloc, also inserting the block index in the bitmap
+// and size in the block to return (for operation)
+void* BuddyAllocator_getBuddy(BuddyAllocator* alloc, int level, size_t size){
+  // lazy mode: a block freed on this level is still marked busy, it is taken as it is
+  if (alloc->deferred[level] != -1){
+    int idx = alloc->deferred[level];
+    alloc->deferred[level] = deferredItem(alloc, idx, level)->next;
+    alloc->num_deferred[level]--;
+    return userPointer(alloc, idx, level, size);
+  }
 
-  // size checks
-  if (size < 0){
-    printf("\nMalloc error: Invalid Size (<0)\n");
+  // look for the smallest free block that can contain the request: first on the
+  // requested level, then going up towards the root (at most num_levels steps)
+  int free_level = level;
+  while (free_level >= 0 && alloc->free_list[free_level] == -1){
+    free_level--;
+  }
+  if (free_level < 0){ // if no free blocks found
+    // the deferred blocks may merge into a large enough one
+    if (BuddyAllocator_coalesce(alloc)) return BuddyAllocator_getBuddy(alloc, level, size);
     return NULL;
   }
+  int bitmap_idx = alloc->free_list[free_level];
+  int purged = freeList_remove(alloc, bitmap_idx, free_level);
+
+  // split the block down to the requested level: we keep the left child,
+  // the right one becomes a free block of its level
+  while (free_level < level){
+    bitmap_idx = bitmap_idx * 2 + 1; // left child
+    free_level++;
+    freeList_pushHalf(alloc, bitmap_idx + 1, free_level, purged); // its buddy
+  }
+
+  // update the bitmap setting to 1 the ancestors and children of the taken block
+  update_child(alloc, bitmap_idx, 1); // both functions set the bit indicating the index
+  update_parent(alloc, bitmap_idx, 1); // of the taken block to 1 (being recursive): no need to do it here
+
+  return userPointer(alloc, bitmap_idx, level, size);
+}
+
+// level of the smallest block that can hold size bytes (overhead included)
+int BuddyAllocator_level(BuddyAllocator* alloc, size_t size){
+  if (size == 0 || size >= alloc->memory_size) return 0;
+  // the memory is a power of 2: the blocks of level l have memory_size >> l bytes, so
+  // the deepest level that fits size is floor(log2(memory_size / size))
+  int level = 63 - __builtin_clzll(alloc->memory_size / size);
+  // if the level is too small, pad it to max
+  if (level > alloc->num_levels){ level = alloc->num_levels; }
+  // a block must be able to hold the free list links once freed
+  while (level > 0 && blockSize(alloc, level) < sizeof(BuddyListItem)){
+    level--;
+  }
+  return level;
+}
+
+void* BuddyAllocator_malloc(BuddyAllocator* alloc, size_t size){
+
+  // size checks
   if (size == 0) {
-    printf("\nMalloc error: Cannot allocate 0 bytes\n");
+    LOG_ERROR("\nMalloc error: Cannot allocate 0 bytes\n");
     return NULL;
   }
 
   // add space to save the block address in the bitmap and its original size
   // to check in pseudo_free whether to deallocate with buddy_free or munmap
-  int org_size = size; // save the original size
-  size += 2 * sizeof(int); // overhead (8 bytes)
+  size_t org_size = size; // save the original size
+  size += overhead(alloc); // overhead (16 bytes, none in headerless mode)
 
   // check available space
-  if (size > alloc->memory_size){
-    printf("\nMalloc error: Requested memory larger than total available memory\n");
+  if (size > alloc->memory_size || size < org_size){
+    LOG_ERROR("\nMalloc error: Requested memory larger than total available memory\n");
+    Stats_failed();
     return NULL;
   }
 
   // determine the level of the page
-  int mem_size = (1 << alloc->num_levels) * alloc->min_bucket_size;
-  // log2(mem_size): n bits to represent the whole memory
-  // log2(size): n bits to represent the requested chunk
-  // bits_mem_size - bits_size = depth of the chunk = level
-  int level = floor(log2(mem_size / size));
-  // if the level is too small, pad it to max
-  if (level > alloc->num_levels){ level = alloc->num_levels; }
+  int level = BuddyAllocator_level(alloc, size);
 
-  printf("\nRequested: %d bytes (+ 8 bytes overhead), required %d bytes, at level %d\n", org_size, alloc->min_bucket_size << (alloc->num_levels - level), level);
+  LOG_TRACE("\nRequested: %zu bytes (+ %zu bytes overhead), required %zu bytes, at level %d\n", org_size, overhead(alloc), blockSize(alloc, level), level);
 
   // find a free block in the bitmap
   void* address = BuddyAllocator_getBuddy(alloc, level, org_size);
   if (address == NULL){
-    printf("Malloc error: no free memory block available\n");
+    LOG_ERROR("Malloc error: no free memory block available\n");
+    Stats_failed();
   }
   else{
-    printf("Allocation succeeded: address %p\n", address);
+    LOG_TRACE("Allocation succeeded: address %p\n", address);
     return address;
   }
   return NULL;
 }
 
+void* BuddyAllocator_mallocAligned(BuddyAllocator* alloc, size_t size, size_t alignment){
+  if (size == 0 || alignment == 0 || (alignment & (alignment - 1)) || size > alloc->memory_size || alignment > alloc->memory_size){
+    LOG_ERROR("\nMalloc error: Invalid alignment (%zu) or size (%zu)\n", alignment, size);
+    return NULL;
+  }
+  // blocks are aligned to their size from the start of the memory: if the memory is
+  // aligned too, a block of at least alignment bytes is aligned
+  int memory_aligned = ((uintptr_t)alloc->memory & (alignment - 1)) == 0;
+  size_t needed;
+  if (alloc->order){ // headerless: the user pointer must be the block itself
+    if (!memory_aligned){
+      LOG_ERROR("\nMalloc error: the memory is not aligned to %zu bytes\n", alignment);
+      return NULL;
+    }
+    needed = size > alignment ? size : alignment;
+  } else if (memory_aligned){ // the header is in the padding before the aligned pointer
+    needed = size + (alignment > overhead(alloc) ? alignment : overhead(alloc));
+  } else {
+    needed = size + overhead(alloc) + alignment - 1;
+  }
+  if (needed > alloc->memory_size){
+    LOG_ERROR("\nMalloc error: Requested memory larger than total available memory\n");
+    return NULL;
+  }
+  char* p = BuddyAllocator_getBuddy(alloc, BuddyAllocator_level(alloc, needed), size);
+  if (!p){
+    LOG_ERROR("Malloc error: no free memory block available\n");
+    return NULL;
+  }
+  if (alloc->order) return p;
+  // move the header right before the aligned pointer, where free looks for it
+  char* ret = (char*)(((uintptr_t)p + alignment - 1) & ~(uintptr_t)(alignment - 1));
+  if (ret != p){
+    header(ret)->idx = header(p)->idx;
+    header(ret)->size = size;
+  }
+  return ret;
+}
+
 void BuddyAllocator_releaseBuddy(BuddyAllocator* alloc, int bit, void* mem){
   // check for double free
-  if (BitMap_bit(&alloc->bitmap, bit) == 0){
-     printf("\nFree error: Memory block at index: %p, already freed (double free).\n", mem);
+  if (BuddyAllocator_bit(alloc, bit) == 0){
+     LOG_ERROR("\nFree error: Memory block at index: %p, already freed (double free).\n", mem);
+    return;
+  }
+  int level = levelIdx(bit);
+  if (alloc->max_deferred){ // lazy mode: the block stays busy in the bitmap, on the stack of its level
+    BuddyHeader* h = (BuddyHeader*)blockAddress(alloc, bit, level);
+    if (!alloc->order){ // the size in the header marks the deferred blocks (headerless ones are out of the order table)
+      if (h->size == DEFERRED_SIZE){
+        LOG_ERROR("\nFree error: Memory block at index: %p, already freed (double free).\n", mem);
+        return;
+      }
+      h->size = DEFERRED_SIZE;
+    }
+    alloc->used_bytes -= blockSize(alloc, level);
+    Stats_buddyFree(level, blockSize(alloc, level));
+    deferredItem(alloc, bit, level)->next = alloc->deferred[level];
+    alloc->deferred[level] = bit;
+    if (++alloc->num_deferred[level] > alloc->max_deferred){ // watermark: merge the level
+      coalesceLevel(alloc, level);
+    }
+    LOG_TRACE("\nFree succeeded: Memory block at index %p deferred\n", mem);
     return;
   }
+  alloc->used_bytes -= blockSize(alloc, level);
+  Stats_buddyFree(level, blockSize(alloc, level));
   // update the children's bit to 0 recursively
-  update_child(&alloc->bitmap, bit, 0);
+  update_child(alloc, bit, 0);
   // update the parent's bit to 0 and try to merge, all recursively
-  merge(&alloc->bitmap, bit);
-  printf("\nFree succeeded: Memory block at index %p freed\n", mem);
+  merge(alloc, bit);
+  LOG_TRACE("\nFree succeeded: Memory block at index %p freed\n", mem);
 }
 
 void BuddyAllocator_free(BuddyAllocator* alloc, void* mem){
   if (!mem){
-    printf("\nFree error: Memory to be freed is NULL\n");
+    LOG_ERROR("\nFree error: Memory to be freed is NULL\n");
+    return;
+  }
+  if (alloc->order){ // headerless: the index comes from the offset and the order table
+    int idx = headerlessIdx(alloc, mem, -1);
+    if (idx == -1){
+      LOG_ERROR("\nFree error: Memory block at index: %p, already freed (double free).\n", mem);
+      return;
+    }
+    alloc->order[((char*)mem - alloc->memory) / alloc->min_bucket_size] = 0;
+    BuddyAllocator_releaseBuddy(alloc, idx, mem);
     return;
   }
   // retrieve the buddy bit in the system, having saved it in memory
-  int* p = (int*) mem;
-  p--; // to skip the size saved in the block
-  int idx = *(--p); // bitmap index of the block
+  BuddyAllocator_releaseBuddy(alloc, header(mem)->idx, mem);
+}
+
+void BuddyAllocator_freeSized(BuddyAllocator* alloc, void* mem, size_t size){
+  if (!mem){
+    LOG_ERROR("\nFree error: Memory to be freed is NULL\n");
+    return;
+  }
+  if (!alloc->order){ // the index is in the header anyway
+    BuddyAllocator_free(alloc, mem);
+    return;
+  }
+  // the level is the one chosen by malloc for this size: no need to read the order table
+  int idx = headerlessIdx(alloc, mem, BuddyAllocator_level(alloc, size));
+  if (idx == -1){
+    LOG_ERROR("\nFree error: Memory block at index: %p is not a block of %zu bytes\n", mem, size);
+    return;
+  }
+  alloc->order[((char*)mem - alloc->memory) / alloc->min_bucket_size] = 0;
   BuddyAllocator_releaseBuddy(alloc, idx, mem);
 }
 
+// takes the first count blocks of the given level inside the free block idx: the bits of the
+// blocks and of their descendants go to 1, as well as those of the partially used nodes,
+// and the unused right halves become free blocks of their level (purged if the block was)
+static int takeBlocks(BuddyAllocator* alloc, int idx, int block_level, int level, int count, size_t size, void** out, int purged){
+  int capacity = 1 << (level - block_level);
+  if (count == capacity){ // the whole subtree
+    update_child(alloc, idx, 1);
+    int first = ((idx + 1) << (level - block_level)) - 1; // leftmost descendant on the level
+    for (int i = 0; i < count; i++){
+      out[i] = userPointer(alloc, first + i, level, size);
+    }
+    return count;
+  }
+  setBit(alloc, idx, 1);
+  int left = idx * 2 + 1;
+  int half = capacity / 2;
+  if (count <= half){
+    freeList_pushHalf(alloc, left + 1, block_level + 1, purged);
+    return takeBlocks(alloc, left, block_level + 1, level, count, size, out, purged);
+  }
+  takeBlocks(alloc, left, block_level + 1, level, half, size, out, purged);
+  return half + takeBlocks(alloc, left + 1, block_level + 1, level, count - half, size, out + half, purged);
+}
+
+int BuddyAllocator_mallocBatch(BuddyAllocator* alloc, size_t size, int n, void** out){
+  if (size == 0 || n <= 0){
+    LOG_ERROR("\nMalloc error: Invalid size (%zu) or number of blocks (%d)\n", size, n);
+    return 0;
+  }
+  if (size > alloc->memory_size - overhead(alloc)){
+    LOG_ERROR("\nMalloc error: Requested memory larger than total available memory\n");
+    Stats_failed();
+    return 0;
+  }
+  int level = BuddyAllocator_level(alloc, size + overhead(alloc));
+  int done = 0;
+  while (done < n){
+    int remaining = n - done;
+    // level of the smallest block that contains all the remaining blocks
+    int target = level;
+    while (target > 0 && (level - target >= 31 || (1 << (level - target)) < remaining)){
+      target--;
+    }
+    // split a free block of that level or above; if there is none, the largest smaller one is used
+    int free_level = target;
+    while (free_level >= 0 && alloc->free_list[free_level] == -1){
+      free_level--;
+    }
+    if (free_level < 0){
+      free_level = target + 1;
+      while (free_level <= level && alloc->free_list[free_level] == -1){
+        free_level++;
+      }
+      if (free_level > level){ // no free memory left, unless deferred blocks merge
+        if (BuddyAllocator_coalesce(alloc)) continue;
+        break;
+      }
+      target = free_level;
+    }
+    int idx = alloc->free_list[free_level];
+    int purged = freeList_remove(alloc, idx, free_level);
+    while (free_level < target){
+      idx = idx * 2 + 1;
+      free_level++;
+      freeList_pushHalf(alloc, idx + 1, free_level, purged);
+    }
+    update_parent(alloc, idx, 1); // the ancestors, once for all the blocks inside
+    int capacity = level - target < 31 ? 1 << (level - target) : INT_MAX;
+    done += takeBlocks(alloc, idx, target, level, remaining < capacity ? remaining : capacity, size, out + done, purged);
+  }
+  if (done < n){
+    LOG_ERROR("Malloc error: no free memory block available for %d of %d blocks\n", n - done, n);
+    Stats_failed();
+    memset(out + done, 0, (n - done) * sizeof(void*));
+  }
+  return done;
+}
+
+static int compareIdx(const void* a, const void* b){
+  int x = *(const int*)a, y = *(const int*)b;
+  return (x > y) - (x < y);
+}
+
+// merges the blocks of idx (sorted, with their bits already cleared), one level at a time from
+// the deepest: a block whose buddy is free, or freed in the same batch, goes up as the parent
+static void mergeBatch(BuddyAllocator* alloc, int* idx, int n){
+  int parents[BUDDY_BATCH_SIZE], next[BUDDY_BATCH_SIZE];
+  int num_parents = 0;
+  int end = n; // the blocks idx[0..end) are still to merge, the deepest are at the end
+  for (int level = levelIdx(idx[n - 1]); level >= 0 && (end > 0 || num_parents > 0); level--){
+    int start = end;
+    while (start > 0 && idx[start - 1] >= firstIdx(level)){
+      start--;
+    }
+    // walk the blocks freed on this level and the parents merged from below, in order
+    int i = start, j = 0, num_next = 0;
+    while (i < end || j < num_parents){
+      int node = (j == num_parents || (i < end && idx[i] < parents[j])) ? idx[i++] : parents[j++];
+      if (node == 0){ // the whole memory is free
+        freeList_push(alloc, 0, 0);
+        continue;
+      }
+      int buddy = buddyIdx(node);
+      if (node % 2 && i < end && idx[i] == buddy){ // both halves in the batch
+        i++;
+      } else if (node % 2 && j < num_parents && parents[j] == buddy){
+        j++;
+      } else if (BuddyAllocator_bit(alloc, buddy) == 0){ // free before the batch
+        freeList_remove(alloc, buddy, level);
+      } else { // the buddy is busy: the block stays free on its level
+        freeList_push(alloc, node, level);
+        continue;
+      }
+      setBit(alloc, parentIdx(node), 0);
+      next[num_next++] = parentIdx(node);
+    }
+    memcpy(parents, next, num_next * sizeof(int));
+    num_parents = num_next;
+    end = start;
+  }
+}
+
+void BuddyAllocator_freeBatch(BuddyAllocator* alloc, void** mems, int n){
+  int idx[BUDDY_BATCH_SIZE];
+  int done = 0;
+  while (done < n){
+    int count = 0;
+    for (; done < n && count < BUDDY_BATCH_SIZE; done++){
+      void* mem = mems[done];
+      if (!mem){
+        LOG_ERROR("\nFree error: Memory to be freed is NULL\n");
+        continue;
+      }
+      int bit = blockIdx(alloc, mem);
+      if (bit == -1 || BuddyAllocator_bit(alloc, bit) == 0){ // also a block twice in the batch
+        LOG_ERROR("\nFree error: Memory block at index: %p, already freed (double free).\n", mem);
+        continue;
+      }
+      if (alloc->order){
+        alloc->order[((char*)mem - alloc->memory) / alloc->min_bucket_size] = 0;
+      }
+      if (alloc->max_deferred){ // lazy mode: deferred one by one, a deferred block still has its bit set
+        BuddyAllocator_releaseBuddy(alloc, bit, mem);
+        continue;
+      }
+      int level = levelIdx(bit);
+      alloc->used_bytes -= blockSize(alloc, level);
+      Stats_buddyFree(level, blockSize(alloc, level));
+      update_child(alloc, bit, 0);
+      idx[count++] = bit;
+    }
+    if (count){
+      qsort(idx, count, sizeof(int), compareIdx);
+      mergeBatch(alloc, idx, count);
+    }
+  }
+}
+
+size_t BuddyAllocator_usableSize(BuddyAllocator* alloc, void* mem){
+  int idx = blockIdx(alloc, mem);
+  if (idx == -1) return 0;
+  int level = levelIdx(idx);
+  // from the user pointer to the end of the block (the header and the padding of aligned blocks are before it)
+  return blockAddress(alloc, idx, level) + blockSize(alloc, level) - (char*)mem;
+}
+
+void* BuddyAllocator_resize(BuddyAllocator* alloc, void* mem, size_t size){
+  int idx = blockIdx(alloc, mem);
+  if (size == 0 || idx == -1 || !BuddyAllocator_bit(alloc, idx)) return NULL; // not allocated
+  int level = levelIdx(idx);
+  char* block = blockAddress(alloc, idx, level);
+  size_t offset = (char*)mem - block; // header, and padding of aligned blocks
+  if (size > alloc->memory_size - offset) return NULL;
+  int new_level = BuddyAllocator_level(alloc, offset + size);
+  size_t old_block_size = blockSize(alloc, level);
+
+  if (new_level > level){ // shrink: the data stays in the leftmost descendant, the right halves are freed
+    while (level < new_level){
+      idx = idx * 2 + 1;
+      level++;
+      update_child(alloc, idx + 1, 0);
+      freeList_push(alloc, idx + 1, level);
+    }
+  }
+  else if (new_level < level){ // grow: the block must be the left half of each ancestor up
+                               // to the new level, and the right halves must be free
+    int ancestor = idx;
+    for (int l = level; l > new_level; l--){
+      if (ancestor % 2 == 0 || BuddyAllocator_bit(alloc, ancestor + 1)) return NULL;
+      ancestor = parentIdx(ancestor);
+    }
+    // merge the free buddies into the block
+    for (int l = level; l > new_level; l--){
+      freeList_remove(alloc, idx + 1, l);
+      idx = parentIdx(idx);
+    }
+    update_child(alloc, idx, 1);
+    level = new_level;
+  }
+
+  // the block starts at the same address, only its index (and size) change
+  alloc->used_bytes += blockSize(alloc, level) - old_block_size;
+  Stats_buddyResize((long long)blockSize(alloc, level) - (long long)old_block_size);
+  if (alloc->order){
+    alloc->order[(block - alloc->memory) / alloc->min_bucket_size] = level + 1;
+  } else {
+    header(mem)->idx = idx;
+    header(mem)->size = size;
+  }
+  return mem;
+}
+
 // when a block is freed, check if its buddy is free, and if so
-// merge, i.e., free the parent block of the buddies.
-void merge(BitMap *bitmap, int bit){
-    if (bit == 0) return; // root
-  
-    int value = BitMap_bit(bitmap, bit);
+// merge, i.e., free the parent block of the buddies, going up until a buddy is busy.
+// The block where the merge stops is added to the free list of its level.
+void merge(BuddyAllocator* alloc, int bit){
+    BitMap* bitmap = &alloc->bitmap;
+    int local;
+    int base = subtreeBase(alloc, bit, &local);
     // sanity check
-    if (value == 1){ 
-      printf("\n Fatal Error in bitmap (merge on bit 1)\n");
-      return;
-    }
-    // find the buddy index and see if it is free or not
-    int buddy = buddyIdx(bit);
-    value = BitMap_bit(bitmap, buddy);
-    if (value == 1){ // if not free do nothing
+    if (BitMap_bit(bitmap, base + local) == 1){
+      LOG_ERROR("\n Fatal Error in bitmap (merge on bit 1)\n");
       return;
     }
-    else { // otherwise set the parent's bit to 0 merging the children, all recursively
-      int parent = parentIdx(bit);
-      BitMap_setBit(bitmap, parent, 0);
-      merge(bitmap, parent); // upward recursion
+    int level = levelIdx(bit);
+    while (bit != 0){ // stop at the root: the whole memory is free again
+      // find the buddy index and see if it is free or not (the buddy of a subtree root is another subtree)
+      int buddy = buddyIdx(bit);
+      if (BitMap_bit(bitmap, local ? base + buddyIdx(local) : bitPos(alloc, buddy)) == 1){
+        break; // if not free the block stays free on its own level
+      }
+      // otherwise set the parent's bit to 0 merging the children
+      freeList_remove(alloc, buddy, level); // the buddy is now part of the parent
+      bit = parentIdx(bit);
+      if (local) local = parentIdx(local);
+      else base = subtreeBase(alloc, bit, &local); // in the band above
+      level--;
+      BitMap_setBit(bitmap, base + local, 0);
     }
+    freeList_push(alloc, bit, level);
 }
 
-// set the bit itself and its parent bit in the bitmap to the given value (1 or 0)
-void update_parent(BitMap *bitmap, int bit, int value) {
-  BitMap_setBit(bitmap,  bit, value);
-  if ( bit > 0) { // stop at the root
-    update_parent(bitmap, parentIdx(bit), value); // upward recursion in the tree
+// set the bit itself and its ancestors in the bitmap to the given value (1 or 0).
+// In the blocked layout the path inside a subtree is a mask of its 63 bits, set with
+// one word for each band
+void update_parent(BuddyAllocator* alloc, int bit, int value) {
+  BitMap* bitmap = &alloc->bitmap;
+  if (alloc->layout == BUDDY_LAYOUT_LEVELS) {
+    BitMap_setBit(bitmap, bit, value);
+    while (bit > 0) { // stop at the root
+      bit = parentIdx(bit);
+      // the ancestors of a busy node are busy too: nothing left to mark
+      if (value && BitMap_bit(bitmap, bit)) break;
+      BitMap_setBit(bitmap, bit, value);
+    }
+    return;
+  }
+  int local;
+  int base = subtreeBase(alloc, bit, &local);
+  uint64_t self = 1ULL << local;
+  while (1) {
+    uint64_t path = 1; // the root of the subtree
+    for (int l = local; l; l = parentIdx(l)) path |= 1ULL << l;
+    int busy = value && (BitMap_getWord(bitmap, base) & path & ~self);
+    BitMap_setMask(bitmap, base, path, value);
+    int root = ((bit + 1) >> levelIdx(local)) - 1; // of the subtree
+    if (busy || root == 0) return;
+    bit = parentIdx(root);
+    base = subtreeBase(alloc, bit, &local);
+    self = 0;
   }
 }
 
-void update_child(BitMap *bitmap, int  bit, int value) {
-  if ( bit < bitmap->num_bits) { // stop when exceeding the bitmap limit
-    BitMap_setBit(bitmap,  bit, value);
-    // binary recursion on the children downwards
-    update_child(bitmap,  bit * 2 + 1, value);  // left
-    update_child(bitmap,  bit * 2 + 2, value);  // right
+// set the bit itself and all its descendants in the bitmap to the given value (1 or 0).
+// The descendants of a node on each level are contiguous in the bitmap:
+// at depth d below bit they are the 2^d bits starting from (bit + 1) * 2^d - 1.
+// In the blocked layout they are contiguous inside the subtree of the node, and from the
+// next band on they are whole subtrees, one after the other: one range for each band
+void update_child(BuddyAllocator* alloc, int bit, int value) {
+  BitMap* bitmap = &alloc->bitmap;
+  int first = bit;
+  int count = 1;
+  if (alloc->layout == BUDDY_LAYOUT_LEVELS) {
+    while (first < bitmap->num_bits) { // stop when exceeding the bitmap limit
+      BitMap_setRange(bitmap, first, first + count, value);
+      first = first * 2 + 1; // leftmost child
+      count *= 2;
+    }
+    return;
+  }
+  int level = levelIdx(bit);
+  while (level <= alloc->num_levels) {
+    int start = bitPos(alloc, first);
+    if (level % BUDDY_BLOCK_LEVELS == 0) { // roots of subtrees: the whole band below them
+      int height = bandHeight(alloc, level);
+      BitMap_setRange(bitmap, start, start + count * ((1 << height) - 1), value);
+      if (level + height > alloc->num_levels) break;
+      first = ((first + 1) << height) - 1;
+      count <<= height;
+      level += height;
+    } else {
+      BitMap_setRange(bitmap, start, start + count, value);
+      first = first * 2 + 1;
+      count *= 2;
+      level++;
+    }
   }
 }
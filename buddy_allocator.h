@@ -1,35 +1,133 @@
 #pragma once
+#include <stddef.h>
 #include "bit_map.h"
 
-#define MAX_LEVELS 20
+#define MAX_LEVELS 30 // bitmap indexes stay below 2^30: with 16 bytes buckets, 8 GB of memory
+#define BUDDY_BATCH_SIZE 256 // blocks freed together by BuddyAllocator_freeBatch, larger batches are split
+#define BUDDY_BLOCK_LEVELS 6 // levels of a subtree in the blocked layout: 63 bits, in one or two 64-bit words
+
+// where the bits of the tree are in the bitmap. The bitmap indexes of the nodes (free lists,
+// headers) are always the level order ones, the layout only moves their bits
+typedef enum {
+    BUDDY_LAYOUT_LEVELS,  // level order: node idx is bit idx, a level follows the one above
+    BUDDY_LAYOUT_BLOCKED  // the tree is cut in bands of BUDDY_BLOCK_LEVELS levels, and every subtree
+                          // of a band is stored contiguously (in level order): a walk from a leaf to
+                          // the root reads a subtree per band instead of a cache line per level
+} BuddyLayout;
 
 typedef struct {
     char* memory; // the memory area to be managed
-    int memory_size;
+    size_t memory_size;
     int num_levels;
-    int min_bucket_size; // the minimum page of RAM that can be returned
+    size_t min_bucket_size; // the minimum page of RAM that can be returned
     BitMap bitmap;
+    BuddyLayout layout;
+    int free_list[MAX_LEVELS]; // per level, bitmap index of the first free block (-1 if the level has none)
+    uint8_t* order; // headerless mode: per minimum bucket, level + 1 of the block allocated there (NULL: blocks have a header)
+    int deferred[MAX_LEVELS]; // lazy mode: per level, stack of the freed blocks not merged yet (-1 if empty)
+    int num_deferred[MAX_LEVELS];
+    int max_deferred; // blocks a level can defer before they are merged (0: lazy mode off)
+    size_t used_bytes;   // bytes of the allocated blocks
+    size_t page_size;
+    size_t dirty_bytes;  // pages of the free blocks that may be resident
+    size_t purged_bytes; // pages of the free blocks given back to the OS by BuddyAllocator_purge
 } BuddyAllocator;
 
+// link stored at the beginning of every free block, to chain the free blocks of the same level
+typedef struct {
+    int next; // bitmap index of the next free block of the level (-1 at the end)
+    int prev : 31; // bitmap index of the previous free block of the level (-1 at the head)
+    unsigned int purged : 1; // the pages of the block were given back to the OS (blocks of 2 pages or more)
+} BuddyListItem;
+
+// written in front of the user pointer of an allocated block (except in headerless mode).
+// 16 bytes, so the user pointers of blocks aligned to 16 bytes are aligned like malloc's
+typedef struct {
+    int idx;     // bitmap index of the block
+    size_t size; // requested size, right before the user pointer (pseudo_is_mapped reads it)
+} BuddyHeader;
+
 // initializes the buddy allocator, and checks that the buffer is large enough
 int BuddyAllocator_init(BuddyAllocator* alloc,
                          int num_levels,
                          char* memory,
-                         int memory_size,
+                         size_t memory_size,
                          char* bitmap_buffer,
                          int bitmap_buffer_size,
-                         int min_bucket_size);
+                         size_t min_bucket_size);
+
+// moves an allocator whose memory and bitmap are now at another address (e.g. a file mapped
+// again): the free lists and the headers hold bitmap indexes, only the two pointers change
+void BuddyAllocator_relocate(BuddyAllocator* alloc, char* memory, char* bitmap_buffer);
+
+// switches a new allocator to headerless blocks: the user pointer is the block itself and
+// its level is kept in order_buffer, a byte for each minimum bucket (memory_size / min_bucket_size)
+int BuddyAllocator_setHeaderless(BuddyAllocator* alloc, uint8_t* order_buffer, int order_buffer_size);
+
+// sets the page size of a new allocator (the system one by default): the unit of
+// BuddyAllocator_purge, e.g. the huge page size for a memory backed by huge pages, which
+// a purge must not split
+int BuddyAllocator_setPageSize(BuddyAllocator* alloc, size_t page_size);
+
+// sets the layout of the bitmap of a new allocator (BUDDY_LAYOUT_LEVELS by default).
+// Returns 0 on success, -1 if the allocator is in use
+int BuddyAllocator_setLayout(BuddyAllocator* alloc, BuddyLayout layout);
+
+// status of the node idx of the tree (1 if busy or split), whatever the layout
+int BuddyAllocator_bit(BuddyAllocator* alloc, int idx);
+
+// lazy coalescing: up to max_deferred freed blocks per level stay busy in the bitmap, on a stack
+// from which the next requests of their level take them without splitting. They are merged
+// when the level exceeds max_deferred, or when a request finds no free block.
+// max_deferred 0 merges all the deferred blocks and turns the mode off
+void BuddyAllocator_setLazy(BuddyAllocator* alloc, int max_deferred);
 
-void* BuddyAllocator_getBuddy(BuddyAllocator* alloc, int level, int size);
+// merges all the deferred blocks, returns how many there were
+int BuddyAllocator_coalesce(BuddyAllocator* alloc);
+
+// gives back to the OS (madvise MADV_DONTNEED) the pages of the free blocks of at least 2 pages,
+// except the first one, which keeps the free list link. Returns the bytes purged: blocks
+// already purged are skipped, a block is dirty again once it is allocated or merged
+size_t BuddyAllocator_purge(BuddyAllocator* alloc);
+
+// level of node idx in the bitmap tree
+int levelIdx(size_t idx);
+
+// level of the smallest block that can hold size bytes (overhead included)
+int BuddyAllocator_level(BuddyAllocator* alloc, size_t size);
+
+void* BuddyAllocator_getBuddy(BuddyAllocator* alloc, int level, size_t size);
 
 void BuddyAllocator_releaseBuddy(BuddyAllocator* alloc, int bit, void* mem);
 
-void* BuddyAllocator_malloc(BuddyAllocator* alloc, int size);
+void* BuddyAllocator_malloc(BuddyAllocator* alloc, size_t size);
+
+// allocates size bytes aligned to alignment (a power of 2), using the alignment of the blocks
+void* BuddyAllocator_mallocAligned(BuddyAllocator* alloc, size_t size, size_t alignment);
 
 void BuddyAllocator_free(BuddyAllocator* alloc, void* mem);
 
-void update_parent(BitMap *bitmap, int bit, int value);
+// bytes that the user can use in an allocated block
+size_t BuddyAllocator_usableSize(BuddyAllocator* alloc, void* mem);
+
+// resizes an allocated block without moving it: shrinking frees the halves no longer needed,
+// growing merges the following buddies if they are free. Returns NULL if it is not possible
+void* BuddyAllocator_resize(BuddyAllocator* alloc, void* mem, size_t size);
+
+// frees a block whose requested size is known, without looking up its level
+void BuddyAllocator_freeSized(BuddyAllocator* alloc, void* mem, size_t size);
+
+// allocates n blocks of size bytes in out: the blocks are split from as few free blocks as
+// possible, whose ancestors are marked once. Returns the number of blocks allocated (the
+// rest of out is set to NULL)
+int BuddyAllocator_mallocBatch(BuddyAllocator* alloc, size_t size, int n, void** out);
+
+// frees n blocks: they are sorted by bitmap index and merged one level at a time, so that
+// a parent is visited once for all the blocks below it
+void BuddyAllocator_freeBatch(BuddyAllocator* alloc, void** mems, int n);
+
+void update_parent(BuddyAllocator* alloc, int bit, int value);
 
-void update_child(BitMap *bitmap, int bit, int value);
+void update_child(BuddyAllocator* alloc, int bit, int value);
 
-void merge(BitMap *bitmap, int bit);
+void merge(BuddyAllocator* alloc, int bit);
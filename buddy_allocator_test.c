@@ -1,10 +1,17 @@
 #include "buddy_allocator.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
 
 #define BUFFER_SIZE 131072 // 128 KB buffer to handle memory
 #define BUDDY_LEVELS 19
 #define MEMORY_SIZE (1024*1024)
 #define MIN_BUCKET_SIZE (MEMORY_SIZE >> BUDDY_LEVELS)
+#define LARGE_LEVELS 26
+#define LARGE_MEMORY_SIZE (4UL << 30) // 4 GB, reserved without being touched
+#define LAYOUT_LEVELS 14 // 15 levels of bits: two bands of 6 levels and one of 3
+#define LAYOUT_MEMORY_SIZE (256*1024)
+#define LAYOUT_BLOCKS 500
 
 char buffer[BUFFER_SIZE];
 char memory[MEMORY_SIZE];
@@ -128,6 +135,392 @@ void test_combined_allocations() {
     printf("== Combined allocation tests completed ==\n");
 }
 
+void test_exhaustion_and_coalescing() {
+    printf("\n== Running exhaustion and coalescing tests ==\n");
+
+    // 1008 bytes + 16 bytes overhead fill exactly a 1 KB block: the memory holds 1024 of them
+    static void* blocks[MEMORY_SIZE / 1024];
+    int num_blocks = MEMORY_SIZE / 1024;
+    int allocated = 0;
+    int in_bounds = 1;
+    for (int i = 0; i < num_blocks; i++) {
+        blocks[i] = BuddyAllocator_malloc(&alloc, 1008);
+        if (blocks[i] == NULL) break;
+        if ((char*)blocks[i] < memory || (char*)blocks[i] + 1008 > memory + MEMORY_SIZE) in_bounds = 0;
+        allocated++;
+    }
+    summary.total_tests++;
+    if (allocated == num_blocks && in_bounds) {
+        summary.passed_tests++;
+        printf("[SUCCESS] Allocated %d blocks of 1 KB inside the managed memory\n", allocated);
+    } else {
+        summary.failed_tests++;
+        printf("[ERROR] Allocated %d/%d blocks of 1 KB (in bounds: %d)\n", allocated, num_blocks, in_bounds);
+    }
+
+    // the memory is full: any other request must fail
+    void* p = BuddyAllocator_malloc(&alloc, 100);
+    print_allocation_result(p, 100, 1); // Expected to fail
+
+    for (int i = 0; i < allocated; i++) {
+        BuddyAllocator_free(&alloc, blocks[i]);
+    }
+
+    // every block has been merged back: the whole memory can be allocated again
+    p = BuddyAllocator_malloc(&alloc, MEMORY_SIZE - 16);
+    print_allocation_result(p, MEMORY_SIZE - 16, 0);
+    BuddyAllocator_free(&alloc, p);
+    print_free_result(p, MEMORY_SIZE - 16);
+
+    printf("== Exhaustion and coalescing tests completed ==\n");
+}
+
+void test_bitmap_ranges() {
+    printf("\n== Running bitmap range tests ==\n");
+
+    // compare the range operations against the single bit ones on random ranges
+    static uint8_t range_buffer[512];
+    BitMap bitmap;
+    int num_bits = 4000;
+    BitMap_init(&bitmap, num_bits, range_buffer);
+    srand(42);
+    int errors = 0;
+    for (int i = 0; i < 2000; i++) {
+        int start = rand() % num_bits;
+        int end = start + rand() % (num_bits - start + 1);
+        int status = rand() % 4 != 0; // mostly full, so that zeros must be searched for
+        BitMap_setRange(&bitmap, start, end, status);
+        for (int b = start; b < end; b++) {
+            if (BitMap_bit(&bitmap, b) != status) errors++;
+        }
+
+        int query_start = rand() % num_bits;
+        int query_end = query_start + rand() % (num_bits - query_start + 1);
+        int first_zero = -1, ones = 0;
+        for (int b = query_start; b < query_end; b++) {
+            if (BitMap_bit(&bitmap, b)) ones++;
+            else if (first_zero == -1) first_zero = b;
+        }
+        if (BitMap_findFirstZero(&bitmap, query_start, query_end) != first_zero) errors++;
+        if (BitMap_popcount(&bitmap, query_start, query_end) != ones) errors++;
+
+        // 64 bits read and written at once, also across the end of the buffer
+        uint64_t word = 0;
+        for (int b = 0; b < 64 && query_start + b < num_bits; b++) {
+            word |= (uint64_t)BitMap_bit(&bitmap, query_start + b) << b;
+        }
+        if (BitMap_getWord(&bitmap, query_start) != word) errors++;
+        uint64_t mask = ((uint64_t)rand() << 32 | rand()) & (num_bits - query_start < 64 ? (1ULL << (num_bits - query_start)) - 1 : ~0ULL);
+        BitMap_setMask(&bitmap, query_start, mask, status);
+        for (int b = 0; b < 64 && query_start + b < num_bits; b++) {
+            int expected = mask >> b & 1 ? status : (int)(word >> b & 1);
+            if (BitMap_bit(&bitmap, query_start + b) != expected) errors++;
+        }
+    }
+    summary.total_tests++;
+    if (errors == 0) {
+        summary.passed_tests++;
+        printf("[SUCCESS] Range set/clear, find first zero, popcount and word operations match the single bit operations\n");
+    } else {
+        summary.failed_tests++;
+        printf("[ERROR] %d mismatches between range and single bit operations\n", errors);
+    }
+
+    printf("== Bitmap range tests completed ==\n");
+}
+
+void test_headerless_mode() {
+    printf("\n== Running headerless mode tests ==\n");
+
+    // 16 byte minimum buckets: the order table needs a byte for each of them
+    #define HL_LEVELS 16
+    static char hl_memory[MEMORY_SIZE];
+    static char hl_bitmap[1 << (HL_LEVELS - 2)];
+    static uint8_t hl_order[1 << HL_LEVELS];
+    BuddyAllocator hl;
+    int ok = BuddyAllocator_init(&hl, HL_LEVELS, hl_memory, MEMORY_SIZE, hl_bitmap, sizeof(hl_bitmap), MEMORY_SIZE >> HL_LEVELS) == 0 &&
+             BuddyAllocator_setHeaderless(&hl, hl_order, sizeof(hl_order)) == 0;
+    summary.total_tests++;
+    if (ok) {
+        summary.passed_tests++;
+        printf("[SUCCESS] Headerless allocator initialized\n");
+    } else {
+        summary.failed_tests++;
+        printf("[ERROR] Headerless allocator not initialized\n");
+        return;
+    }
+
+    // without header a 16 byte request fits a 16 byte block, aligned to its size
+    void* p1 = BuddyAllocator_malloc(&hl, 16);
+    void* p2 = BuddyAllocator_malloc(&hl, 16);
+    print_allocation_result(p1, 16, 0);
+    summary.total_tests++;
+    if (p1 && p2 && (char*)p2 - (char*)p1 == 16 && ((char*)p1 - hl_memory) % 16 == 0) {
+        summary.passed_tests++;
+        printf("[SUCCESS] 16 byte blocks are adjacent and aligned (no header)\n");
+    } else {
+        summary.failed_tests++;
+        printf("[ERROR] 16 byte blocks at %p and %p\n", p1, p2);
+    }
+    void* p3 = BuddyAllocator_malloc(&hl, 4096);
+    print_allocation_result(p3, 4096, 0);
+
+    BuddyAllocator_free(&hl, p1);
+    BuddyAllocator_freeSized(&hl, p2, 16);
+    BuddyAllocator_freeSized(&hl, p3, 4096);
+    BuddyAllocator_free(&hl, p1); // double free: reported, nothing changes
+
+    void* p = BuddyAllocator_malloc(&hl, MEMORY_SIZE);
+    print_allocation_result(p, MEMORY_SIZE, 0);
+    BuddyAllocator_free(&hl, p);
+
+    printf("== Headerless mode tests completed ==\n");
+}
+
+void test_resize() {
+    printf("\n== Running in place resize tests ==\n");
+
+    // 1008 + 16 bytes fill a 1 KB block, 112 + 16 bytes a 128 bytes block
+    void* p1 = BuddyAllocator_malloc(&alloc, 1008);
+    print_allocation_result(p1, 1008, 0);
+    void* shrunk = BuddyAllocator_resize(&alloc, p1, 112);
+    summary.total_tests++;
+    if (shrunk == p1 && BuddyAllocator_usableSize(&alloc, p1) == 112) {
+        summary.passed_tests++;
+        printf("[SUCCESS] Shrunk 1008 bytes to 112 bytes in place\n");
+    } else {
+        summary.failed_tests++;
+        printf("[ERROR] Shrink in place returned %p, usable size %zu\n", shrunk, BuddyAllocator_usableSize(&alloc, p1));
+    }
+
+    // the freed halves are available: they are the buddies the block grows into
+    void* grown = BuddyAllocator_resize(&alloc, p1, 4000);
+    summary.total_tests++;
+    if (grown == p1 && BuddyAllocator_usableSize(&alloc, p1) == 4096 - 16) {
+        summary.passed_tests++;
+        printf("[SUCCESS] Grown 112 bytes to 4000 bytes in place\n");
+    } else {
+        summary.failed_tests++;
+        printf("[ERROR] Grow in place returned %p, usable size %zu\n", grown, BuddyAllocator_usableSize(&alloc, p1));
+    }
+
+    // a busy buddy blocks the growth
+    void* p2 = BuddyAllocator_malloc(&alloc, 4000);
+    print_allocation_result(p2, 4000, 0);
+    grown = BuddyAllocator_resize(&alloc, p1, 8000);
+    print_allocation_result(grown, 8000, 1); // Expected to fail
+
+    BuddyAllocator_free(&alloc, p1);
+    BuddyAllocator_free(&alloc, p2);
+    void* p = BuddyAllocator_malloc(&alloc, MEMORY_SIZE - 16);
+    print_allocation_result(p, MEMORY_SIZE - 16, 0);
+    BuddyAllocator_free(&alloc, p);
+
+    printf("== In place resize tests completed ==\n");
+}
+
+void check(int passed, const char* description) {
+    summary.total_tests++;
+    if (passed) {
+        summary.passed_tests++;
+        printf("[SUCCESS] %s\n", description);
+    } else {
+        summary.failed_tests++;
+        printf("[ERROR] %s\n", description);
+    }
+}
+
+void test_batch() {
+    printf("\n== Running batch allocation tests ==\n");
+
+    // 48 + 16 bytes fill a 64 bytes block: a batch is split from a single free block
+    static void* blocks[2000];
+    int n = BuddyAllocator_mallocBatch(&alloc, 48, 100, blocks);
+    int adjacent = n == 100;
+    for (int i = 1; i < n; i++) {
+        if ((char*)blocks[i] - (char*)blocks[i - 1] != 64) adjacent = 0;
+    }
+    check(adjacent, "Batch of 100 blocks of 48 bytes split from one block, adjacent");
+    void* single = BuddyAllocator_malloc(&alloc, 48);
+    check(single && (char*)single - (char*)blocks[99] == 64, "Next malloc takes the block after the batch");
+
+    // free every other block in a batch, in reverse order, then the rest one by one
+    void* even[50];
+    for (int i = 0; i < 50; i++) even[i] = blocks[98 - 2 * i];
+    BuddyAllocator_freeBatch(&alloc, even, 50);
+    void* again = BuddyAllocator_malloc(&alloc, 48);
+    int reused = 0;
+    for (int i = 0; i < 50; i++) reused |= again == even[i];
+    check(reused, "A block freed by the batch is reused");
+    BuddyAllocator_free(&alloc, again);
+    for (int i = 1; i < 100; i += 2) BuddyAllocator_free(&alloc, blocks[i]);
+    BuddyAllocator_free(&alloc, single);
+    void* p = BuddyAllocator_malloc(&alloc, MEMORY_SIZE - 16);
+    check(p != NULL, "Whole memory free after the batch and single frees");
+    BuddyAllocator_free(&alloc, p);
+
+    // more blocks than the memory holds: the batch stops at 1024 blocks of 1 KB
+    n = BuddyAllocator_mallocBatch(&alloc, 1008, 2000, blocks);
+    check(n == MEMORY_SIZE / 1024 && blocks[n] == NULL, "Batch larger than the memory allocates what fits");
+    blocks[n] = blocks[0]; // a block twice in the batch: the second one is reported and skipped
+    BuddyAllocator_freeBatch(&alloc, blocks, n + 1);
+    p = BuddyAllocator_malloc(&alloc, MEMORY_SIZE - 16);
+    check(p != NULL, "Whole memory merged back by a batch free of 1024 blocks");
+    BuddyAllocator_free(&alloc, p);
+
+    // the halves split from a purged block keep its purged pages
+    BuddyAllocator_purge(&alloc);
+    n = BuddyAllocator_mallocBatch(&alloc, 48, 10, blocks);
+    check(n == 10 && alloc.dirty_bytes == 0, "Halves split by a batch from a purged block stay purged");
+    BuddyAllocator_freeBatch(&alloc, blocks, n);
+
+    printf("== Batch allocation tests completed ==\n");
+}
+
+void test_lazy() {
+    printf("\n== Running lazy coalescing tests ==\n");
+
+    BuddyAllocator_setLazy(&alloc, 4);
+    void* a = BuddyAllocator_malloc(&alloc, 48);
+    void* b = BuddyAllocator_malloc(&alloc, 48);
+    BuddyAllocator_free(&alloc, a);
+    void* c = BuddyAllocator_malloc(&alloc, 48);
+    check(c == a, "Deferred block reused as it is");
+    BuddyAllocator_free(&alloc, c);
+    BuddyAllocator_free(&alloc, c); // reported, not deferred twice
+    check(alloc.num_deferred[BuddyAllocator_level(&alloc, 64)] == 1, "Double free of a deferred block detected");
+
+    // past the watermark the whole level is merged
+    void* blocks[8];
+    for (int i = 0; i < 8; i++) blocks[i] = BuddyAllocator_malloc(&alloc, 48);
+    for (int i = 0; i < 5; i++) BuddyAllocator_free(&alloc, blocks[i]);
+    check(alloc.num_deferred[BuddyAllocator_level(&alloc, 64)] == 0, "Level merged past the watermark");
+
+    // the deferred blocks are merged when a request finds no free block
+    for (int i = 5; i < 8; i++) BuddyAllocator_free(&alloc, blocks[i]);
+    BuddyAllocator_free(&alloc, b);
+    void* p = BuddyAllocator_malloc(&alloc, MEMORY_SIZE - 16);
+    check(p != NULL, "Deferred blocks merged for a request of the whole memory");
+    BuddyAllocator_free(&alloc, p);
+    check(BuddyAllocator_coalesce(&alloc) == 1, "Coalesce merges the deferred blocks");
+
+    // batch frees are deferred too, a block deferred already is not merged behind its stack
+    a = BuddyAllocator_malloc(&alloc, 48);
+    b = BuddyAllocator_malloc(&alloc, 48);
+    BuddyAllocator_free(&alloc, a);
+    void* batch[2] = {a, b};
+    BuddyAllocator_freeBatch(&alloc, batch, 2);
+    check(alloc.num_deferred[BuddyAllocator_level(&alloc, 64)] == 2, "Batch free deferred, double free of a deferred block detected");
+
+    BuddyAllocator_setLazy(&alloc, 0);
+    p = BuddyAllocator_malloc(&alloc, MEMORY_SIZE - 16);
+    check(p != NULL, "Whole memory free with the lazy mode off");
+    BuddyAllocator_free(&alloc, p);
+
+    printf("== Lazy coalescing tests completed ==\n");
+}
+
+void test_large_memory() {
+    printf("\n== Running multi-gigabyte memory tests ==\n");
+
+    char* large = mmap(NULL, LARGE_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    int bitmap_size = BitMap_getBytes((1 << (LARGE_LEVELS + 1)) - 1);
+    char* bitmap = mmap(NULL, bitmap_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (large == MAP_FAILED || bitmap == MAP_FAILED) {
+        printf("[INFO] Cannot reserve 4 GB, skipped\n");
+        return;
+    }
+    BuddyAllocator big;
+    check(BuddyAllocator_init(&big, LARGE_LEVELS, large, LARGE_MEMORY_SIZE, bitmap, bitmap_size, LARGE_MEMORY_SIZE >> LARGE_LEVELS) == 0,
+          "Buddy allocator of 4 GB with 26 levels");
+
+    // more than 2 GB: the whole memory, its size does not fit an int
+    size_t size = (3UL << 30);
+    char* p = BuddyAllocator_malloc(&big, size);
+    check(p == large + sizeof(BuddyHeader) && BuddyAllocator_usableSize(&big, p) == LARGE_MEMORY_SIZE - sizeof(BuddyHeader),
+          "Block of 3 GB allocated");
+    if (p) {
+        p[size - 1] = 1; // only this page becomes resident
+        check(big.used_bytes == LARGE_MEMORY_SIZE, "4 GB block accounted");
+        BuddyAllocator_free(&big, p);
+    }
+
+    void* halves[3];
+    for (int i = 0; i < 3; i++) halves[i] = BuddyAllocator_malloc(&big, (2UL << 30) - sizeof(BuddyHeader));
+    check(halves[0] && halves[1] && (char*)halves[1] - (char*)halves[0] == (2L << 30) && halves[2] == NULL,
+          "Two blocks of 2 GB, the third fails");
+    BuddyAllocator_free(&big, halves[1]);
+    BuddyAllocator_free(&big, halves[0]);
+    check(big.used_bytes == 0 && BuddyAllocator_malloc(&big, size) == large + sizeof(BuddyHeader), "Blocks merged back into 4 GB");
+
+    munmap(bitmap, bitmap_size);
+    munmap(large, LARGE_MEMORY_SIZE);
+    printf("== Multi-gigabyte memory tests completed ==\n");
+}
+
+void test_blocked_layout() {
+    printf("\n== Running blocked bitmap layout tests ==\n");
+
+    // the same operations on an allocator of each layout: same blocks, same tree
+    static char memories[2][LAYOUT_MEMORY_SIZE];
+    static char bitmaps[2][BUFFER_SIZE];
+    BuddyAllocator allocs[2];
+    for (int i = 0; i < 2; i++) {
+        BuddyAllocator_init(&allocs[i], LAYOUT_LEVELS, memories[i], LAYOUT_MEMORY_SIZE, bitmaps[i], BUFFER_SIZE, LAYOUT_MEMORY_SIZE >> LAYOUT_LEVELS);
+    }
+    check(BuddyAllocator_setLayout(&allocs[1], BUDDY_LAYOUT_BLOCKED) == 0 && allocs[1].layout == BUDDY_LAYOUT_BLOCKED,
+          "Blocked layout set on a new allocator");
+
+    static void* blocks[2][LAYOUT_BLOCKS];
+    int same_blocks = 1;
+    srand(7);
+    for (int step = 0; step < 20000; step++) {
+        int slot = rand() % LAYOUT_BLOCKS;
+        int op = rand() % 8;
+        size_t size = 1 + rand() % (rand() % 4 ? 200 : 20000);
+        for (int i = 0; i < 2; i++) {
+            void** block = &blocks[i][slot];
+            if (*block && op == 0) {
+                void* resized = BuddyAllocator_resize(&allocs[i], *block, size);
+                if (resized) *block = resized;
+            } else if (*block) {
+                BuddyAllocator_free(&allocs[i], *block);
+                *block = NULL;
+            } else if (op == 1 && slot + 8 <= LAYOUT_BLOCKS) { // a batch in the free slots
+                void* batch[8];
+                int n = BuddyAllocator_mallocBatch(&allocs[i], size, 8, batch);
+                for (int j = 0; j < n; j++) {
+                    if (!blocks[i][slot + j]) blocks[i][slot + j] = batch[j];
+                    else BuddyAllocator_free(&allocs[i], batch[j]);
+                }
+            } else {
+                *block = BuddyAllocator_malloc(&allocs[i], size);
+            }
+        }
+        for (int j = slot; j < slot + 8 && j < LAYOUT_BLOCKS; j++) {
+            if (!blocks[0][j] != !blocks[1][j] ||
+                (blocks[0][j] && (char*)blocks[0][j] - memories[0] != (char*)blocks[1][j] - memories[1])) same_blocks = 0;
+        }
+    }
+    int num_bits = allocs[0].bitmap.num_bits;
+    int same_tree = BitMap_popcount(&allocs[0].bitmap, 0, num_bits) == BitMap_popcount(&allocs[1].bitmap, 0, num_bits);
+    for (int idx = 0; idx < num_bits; idx++) {
+        if (BuddyAllocator_bit(&allocs[0], idx) != BuddyAllocator_bit(&allocs[1], idx)) same_tree = 0;
+    }
+    check(same_blocks, "Same blocks returned with both layouts after 20000 random operations");
+    check(same_tree && allocs[0].used_bytes == allocs[1].used_bytes, "Same tree in both bitmaps");
+    check(BuddyAllocator_setLayout(&allocs[1], BUDDY_LAYOUT_LEVELS) == -1, "Layout of an allocator in use not changed");
+
+    BuddyAllocator_freeBatch(&allocs[1], blocks[1], LAYOUT_BLOCKS / 2);
+    for (int j = LAYOUT_BLOCKS / 2; j < LAYOUT_BLOCKS; j++) {
+        if (blocks[1][j]) BuddyAllocator_free(&allocs[1], blocks[1][j]);
+    }
+    check(allocs[1].used_bytes == 0 && BitMap_popcount(&allocs[1].bitmap, 0, num_bits) == 0 &&
+          BuddyAllocator_malloc(&allocs[1], LAYOUT_MEMORY_SIZE - 16) != NULL, "Blocked tree merged back into the whole memory");
+
+    printf("== Blocked bitmap layout tests completed ==\n");
+}
+
 void print_final_summary() {
     printf("\n========== TEST SUMMARY ==========\n");
     printf("Total tests run: %d\n", summary.total_tests);
@@ -149,6 +542,14 @@ int main(int argc, char** argv) {
     test_large_allocations();
     test_edge_cases();
     test_combined_allocations();
+    test_exhaustion_and_coalescing();
+    test_bitmap_ranges();
+    test_headerless_mode();
+    test_resize();
+    test_batch();
+    test_lazy();
+    test_large_memory();
+    test_blocked_layout();
 
     // Print final results
     print_final_summary();
@@ -0,0 +1,219 @@
+#include <string.h>
+#include "concurrent_buddy.h"
+#include "log.h"
+#include "stats.h"
+
+static int level_of(int idx){
+    return 31 - __builtin_clz(idx + 1);
+}
+
+static int parent_of(int idx){
+    return (idx - 1) / 2;
+}
+
+// flags of child in the status of its parent, and of its buddy
+static uint8_t occ_flag(int child){
+    return child & 1 ? NODE_OCC_LEFT : NODE_OCC_RIGHT;
+}
+
+static uint8_t coal_flag(int child){
+    return child & 1 ? NODE_COAL_LEFT : NODE_COAL_RIGHT;
+}
+
+static uint8_t buddy_occ_flag(int child){
+    return child & 1 ? NODE_OCC_RIGHT : NODE_OCC_LEFT;
+}
+
+static uint8_t buddy_coal_flag(int child){
+    return child & 1 ? NODE_COAL_RIGHT : NODE_COAL_LEFT;
+}
+
+static size_t block_size(ConcurrentBuddy* cb, int level){
+    return cb->min_bucket_size << (cb->num_levels - level);
+}
+
+static char* block_address(ConcurrentBuddy* cb, int idx){
+    int level = level_of(idx);
+    return cb->memory + (size_t)(idx - ((1 << level) - 1)) * block_size(cb, level);
+}
+
+int ConcurrentBuddy_getBytes(int num_levels){
+    return (1 << (num_levels + 1)) - 1;
+}
+
+int ConcurrentBuddy_init(ConcurrentBuddy* cb,
+                         int num_levels,
+                         char* memory,
+                         size_t memory_size,
+                         uint8_t* nodes_buffer,
+                         int nodes_buffer_size,
+                         size_t min_bucket_size){
+    if (!memory || !nodes_buffer){
+        LOG_ERROR("Error: Memory or node buffer pointer provided is NULL\n");
+        return -1;
+    }
+    if (num_levels < 0 || num_levels >= MAX_LEVELS){
+        LOG_ERROR("Error: Number of levels exceeds the maximum (%d)\n", MAX_LEVELS);
+        return -1;
+    }
+    if (min_bucket_size != memory_size >> num_levels || min_bucket_size < sizeof(BuddyHeader)){
+        LOG_ERROR("Error: Invalid min_bucket_size\n");
+        return -1;
+    }
+    if (nodes_buffer_size < ConcurrentBuddy_getBytes(num_levels)){
+        LOG_ERROR("Error: Insufficient memory provided for the nodes: requires %d bytes\n", ConcurrentBuddy_getBytes(num_levels));
+        return -1;
+    }
+    cb->memory = memory;
+    cb->memory_size = min_bucket_size << num_levels; // the largest power of 2 in memory_size
+    cb->num_levels = num_levels;
+    cb->min_bucket_size = min_bucket_size;
+    cb->nodes = nodes_buffer;
+    cb->num_nodes = ConcurrentBuddy_getBytes(num_levels);
+    memset(nodes_buffer, 0, cb->num_nodes);
+    return 0;
+}
+
+// releases node n and clears its marks in the ancestors up to top (included)
+static void release(ConcurrentBuddy* cb, int n, int top){
+    // flags the ancestors as coalescing, up to the first one that stays occupied by the other child
+    for (int child = n; child != top;){
+        int parent = parent_of(child);
+        uint8_t old = __atomic_fetch_or(&cb->nodes[parent], coal_flag(child), __ATOMIC_ACQ_REL);
+        if ((old & buddy_occ_flag(child)) && !(old & buddy_coal_flag(child))) break;
+        child = parent;
+    }
+    __atomic_store_n(&cb->nodes[n], 0, __ATOMIC_RELEASE);
+    for (int child = n; child != top;){
+        int parent = parent_of(child);
+        uint8_t old = __atomic_load_n(&cb->nodes[parent], __ATOMIC_RELAXED);
+        uint8_t new;
+        do {
+            if (!(old & coal_flag(child))) return; // an allocation took this side again
+            new = old & ~(occ_flag(child) | coal_flag(child));
+        } while (!__atomic_compare_exchange_n(&cb->nodes[parent], &old, new, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+        if (new & buddy_occ_flag(child)) return; // the parent is still partially occupied
+        child = parent;
+    }
+}
+
+// claims the free node n and marks it in its ancestors: returns -1 on success, otherwise
+// the node that was not free (n itself, or an allocated ancestor)
+static int claim(ConcurrentBuddy* cb, int n){
+    uint8_t free = 0;
+    if (!__atomic_compare_exchange_n(&cb->nodes[n], &free, NODE_BUSY, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) return n;
+    for (int child = n; child != 0;){
+        int parent = parent_of(child);
+        uint8_t old = __atomic_load_n(&cb->nodes[parent], __ATOMIC_RELAXED);
+        uint8_t new;
+        do {
+            if (old & NODE_OCC){ // taken by an allocation of a larger block: undoes the marks below it
+                release(cb, n, child);
+                return parent;
+            }
+            new = (old & ~coal_flag(child)) | occ_flag(child);
+        } while (!__atomic_compare_exchange_n(&cb->nodes[parent], &old, new, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+        child = parent;
+    }
+    return -1;
+}
+
+// per thread, the searches start at a random node of the level, so that the threads
+// do not compete for the same nodes
+static __thread uint32_t seed;
+
+static uint32_t next_random(void){
+    if (!seed) seed = (uint32_t)(uintptr_t)&seed | 1;
+    seed ^= seed << 13; // xorshift32
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+void* ConcurrentBuddy_malloc(ConcurrentBuddy* cb, size_t size){
+    if (size == 0){
+        LOG_ERROR("\nMalloc error: Invalid Size (%zu)\n", size);
+        return NULL;
+    }
+    size_t needed = size + sizeof(BuddyHeader); // header: bitmap index and size
+    if (needed > cb->memory_size || needed < size){
+        LOG_ERROR("\nMalloc error: Requested memory larger than total available memory\n");
+        Stats_failed();
+        return NULL;
+    }
+    size_t buckets = (needed + cb->min_bucket_size - 1) / cb->min_bucket_size;
+    int level = cb->num_levels - (buckets > 1 ? 64 - __builtin_clzll(buckets - 1) : 0);
+
+    int first = (1 << level) - 1;
+    int count = 1 << level;
+    int start = next_random() & (count - 1);
+    for (int i = 0; i < count;){
+        int n = first + ((start + i) & (count - 1));
+        if (__atomic_load_n(&cb->nodes[n], __ATOMIC_RELAXED)){
+            i++;
+            continue;
+        }
+        int taken = claim(cb, n);
+        if (taken < 0){
+            BuddyHeader* header = (BuddyHeader*)block_address(cb, n);
+            header->idx = n;
+            header->size = size;
+            Stats_buddyAlloc(level, block_size(cb, level), size);
+            return header + 1;
+        }
+        // skips the nodes of the level below the one that was taken
+        int depth = level - level_of(taken);
+        int last = ((taken + 1) << depth) - 1 + (1 << depth) - 1;
+        i += last - n + 1;
+    }
+    LOG_ERROR("Malloc error: no free memory block available\n");
+    Stats_failed();
+    return NULL;
+}
+
+void ConcurrentBuddy_free(ConcurrentBuddy* cb, void* mem){
+    if (!mem){
+        LOG_ERROR("\nFree error: Memory to be freed is NULL\n");
+        return;
+    }
+    int idx = ((BuddyHeader*)mem - 1)->idx;
+    if (idx < 0 || idx >= cb->num_nodes || block_address(cb, idx) != (char*)mem - sizeof(BuddyHeader)){
+        LOG_ERROR("\nFree error: %p is not a block of the allocator\n", mem);
+        return;
+    }
+    if (__atomic_load_n(&cb->nodes[idx], __ATOMIC_RELAXED) != NODE_BUSY){
+        LOG_ERROR("\nFree error: the block %p is not allocated\n", mem);
+        return;
+    }
+    int level = level_of(idx);
+    Stats_buddyFree(level, block_size(cb, level));
+    release(cb, idx, 0);
+}
+
+size_t ConcurrentBuddy_usableSize(ConcurrentBuddy* cb, void* mem){
+    return block_size(cb, level_of(((BuddyHeader*)mem - 1)->idx)) - sizeof(BuddyHeader);
+}
+
+long ConcurrentBuddy_check(ConcurrentBuddy* cb){
+    long bytes = 0;
+    for (int i = 0; i < cb->num_nodes; i++){
+        uint8_t status = cb->nodes[i];
+        int leaf = level_of(i) == cb->num_levels;
+        int valid;
+        if (status & NODE_OCC){ // allocated: nothing below it
+            valid = status == NODE_BUSY && (leaf || (cb->nodes[2 * i + 1] == 0 && cb->nodes[2 * i + 2] == 0));
+            bytes += block_size(cb, level_of(i));
+        } else if (leaf){
+            valid = status == 0;
+        } else { // the flags of the children tell whether they are used
+            valid = !(status & (NODE_COAL_LEFT | NODE_COAL_RIGHT))
+                    && !(status & NODE_OCC_LEFT) == !cb->nodes[2 * i + 1]
+                    && !(status & NODE_OCC_RIGHT) == !cb->nodes[2 * i + 2];
+        }
+        if (!valid){
+            LOG_ERROR("Check error: node %d has the inconsistent status 0x%x\n", i, status);
+            return -1;
+        }
+    }
+    return bytes;
+}
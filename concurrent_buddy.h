@@ -0,0 +1,52 @@
+#pragma once
+#include <stdint.h>
+#include "buddy_allocator.h"
+
+// Buddy allocator without locks, for blocks allocated and freed by any thread. Every node
+// of the tree has a status byte, updated with atomic compare-and-swap:
+// - NODE_OCC: the block of the node is allocated (with NODE_OCC_LEFT | NODE_OCC_RIGHT, so
+//   that the node looks full to a search below it)
+// - NODE_OCC_LEFT/RIGHT: the subtree of that child has allocated blocks
+// - NODE_COAL_LEFT/RIGHT: a free below that child is clearing the marks of the ancestors
+// An allocation claims a free node at its level (0 -> busy) and marks its side in all the
+// ancestors, clearing their coalescing flag; it backs off if an ancestor is allocated.
+// A free flags the ancestors as coalescing, releases the node, then clears the ancestors
+// as long as their flag is still there (an allocation in the meantime removes it) and the
+// other child is free. Scheme of the non-blocking buddy system of Marotta et al.
+#define NODE_OCC 0x01
+#define NODE_OCC_LEFT 0x02
+#define NODE_OCC_RIGHT 0x04
+#define NODE_COAL_LEFT 0x08
+#define NODE_COAL_RIGHT 0x10
+#define NODE_BUSY (NODE_OCC | NODE_OCC_LEFT | NODE_OCC_RIGHT)
+
+typedef struct {
+    char* memory;
+    size_t memory_size;
+    int num_levels;
+    size_t min_bucket_size;
+    uint8_t* nodes; // status of the nodes: root 0, children of i at 2i+1 and 2i+2
+    int num_nodes;
+} ConcurrentBuddy;
+
+// bytes of the node buffer of an allocator with num_levels levels
+int ConcurrentBuddy_getBytes(int num_levels);
+
+// initializes the allocator, with the same constraints of BuddyAllocator_init
+int ConcurrentBuddy_init(ConcurrentBuddy* cb,
+                         int num_levels,
+                         char* memory,
+                         size_t memory_size,
+                         uint8_t* nodes_buffer,
+                         int nodes_buffer_size,
+                         size_t min_bucket_size);
+
+// blocks have the header of the buddy allocator (bitmap index and size), so any thread can free them
+void* ConcurrentBuddy_malloc(ConcurrentBuddy* cb, size_t size);
+void ConcurrentBuddy_free(ConcurrentBuddy* cb, void* mem);
+
+size_t ConcurrentBuddy_usableSize(ConcurrentBuddy* cb, void* mem);
+
+// checks the status of every node, to be called while no thread uses the allocator.
+// Returns the bytes of the allocated blocks, -1 if the tree is inconsistent
+long ConcurrentBuddy_check(ConcurrentBuddy* cb);
@@ -0,0 +1,175 @@
+#include "concurrent_buddy.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#define BUDDY_LEVELS 14
+#define MEMORY_SIZE (1024*1024)
+#define MIN_BUCKET_SIZE (MEMORY_SIZE >> BUDDY_LEVELS)
+#define NUM_THREADS 8
+#define OPS_PER_THREAD 250000
+#define NUM_SLOTS 1024
+#define MAX_SIZE 1000
+
+char memory[MEMORY_SIZE];
+uint8_t nodes[1 << (BUDDY_LEVELS + 1)];
+
+ConcurrentBuddy buddy;
+
+// blocks shared by all the threads: a block is freed by the thread that takes it from its slot
+void* slots[NUM_SLOTS];
+
+typedef struct {
+    int total_tests;
+    int passed_tests;
+} TestResult;
+
+TestResult test_result = {0, 0};
+
+void print_test_result(bool passed, const char* description) {
+    test_result.total_tests++;
+    if (passed) {
+        test_result.passed_tests++;
+        printf("[SUCCESS] %s\n", description);
+    } else {
+        printf("[ERROR] %s\n", description);
+    }
+}
+
+// a block is filled with a pattern of its address: an overlap with another block corrupts it
+void fill(void* p) {
+    memset(p, (int)((uintptr_t)p >> 4), ConcurrentBuddy_usableSize(&buddy, p));
+}
+
+bool intact(void* p) {
+    unsigned char expected[2 * MAX_SIZE];
+    int size = ConcurrentBuddy_usableSize(&buddy, p);
+    if (size > (int)sizeof(expected)) size = sizeof(expected);
+    memset(expected, (int)((uintptr_t)p >> 4), size);
+    return memcmp(p, expected, size) == 0;
+}
+
+void test_single_thread() {
+    printf("\n== Running single thread tests ==\n");
+
+    void* p1 = ConcurrentBuddy_malloc(&buddy, 100);
+    void* p2 = ConcurrentBuddy_malloc(&buddy, 100);
+    print_test_result(p1 && p2 && p1 != p2, "Two blocks of 100 bytes");
+    print_test_result(ConcurrentBuddy_usableSize(&buddy, p1) == 128 - 16, "Block of 128 bytes with the header");
+    print_test_result(ConcurrentBuddy_check(&buddy) == 256, "Tree consistent with two allocated blocks");
+    print_test_result(ConcurrentBuddy_malloc(&buddy, MEMORY_SIZE - 16) == NULL, "Correctly failed to allocate the whole memory");
+    ConcurrentBuddy_free(&buddy, p1);
+    ConcurrentBuddy_free(&buddy, p1); // double free: rejected
+    ConcurrentBuddy_free(&buddy, p2);
+    print_test_result(ConcurrentBuddy_check(&buddy) == 0, "Tree consistent and empty after the frees");
+
+    void* whole = ConcurrentBuddy_malloc(&buddy, MEMORY_SIZE - 16);
+    print_test_result(whole == memory + 16, "Whole memory allocated after the merges");
+    print_test_result(ConcurrentBuddy_malloc(&buddy, 1) == NULL, "Correctly failed to allocate from a full memory");
+    ConcurrentBuddy_free(&buddy, whole);
+
+    // every minimum bucket, then every block of a level twice as large
+    int count = 0;
+    while (ConcurrentBuddy_malloc(&buddy, MIN_BUCKET_SIZE - 16)) count++;
+    print_test_result(count == MEMORY_SIZE / MIN_BUCKET_SIZE, "All the minimum buckets allocated");
+    print_test_result(ConcurrentBuddy_check(&buddy) == MEMORY_SIZE, "Tree consistent with a full memory");
+    for (int i = 0; i < count; i++) ConcurrentBuddy_free(&buddy, memory + i * MIN_BUCKET_SIZE + 16);
+    count = 0;
+    while (ConcurrentBuddy_malloc(&buddy, 2 * MIN_BUCKET_SIZE - 16)) count++;
+    print_test_result(count == MEMORY_SIZE / MIN_BUCKET_SIZE / 2, "All the blocks of the next level allocated after the merges");
+    for (int i = 0; i < count; i++) ConcurrentBuddy_free(&buddy, memory + i * 2 * MIN_BUCKET_SIZE + 16);
+    print_test_result(ConcurrentBuddy_check(&buddy) == 0, "Tree consistent and empty");
+
+    printf("== Single thread tests completed ==\n");
+}
+
+// random allocations and frees on the shared slots: most blocks are freed by another thread
+void* worker(void* arg) {
+    uint32_t seed = (uint32_t)(size_t)arg * 2654435761u + 1;
+    long corrupted = 0;
+    for (int i = 0; i < OPS_PER_THREAD; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        int slot = seed % NUM_SLOTS;
+        void* p = __atomic_exchange_n(&slots[slot], NULL, __ATOMIC_ACQ_REL);
+        if (p) {
+            if (!intact(p)) corrupted++;
+            ConcurrentBuddy_free(&buddy, p);
+            continue;
+        }
+        p = ConcurrentBuddy_malloc(&buddy, 1 + (seed >> 8) % MAX_SIZE);
+        if (!p) continue;
+        fill(p);
+        p = __atomic_exchange_n(&slots[slot], p, __ATOMIC_ACQ_REL);
+        if (p) { // another thread filled the slot in the meantime
+            if (!intact(p)) corrupted++;
+            ConcurrentBuddy_free(&buddy, p);
+        }
+    }
+    return (void*)corrupted;
+}
+
+void test_threads() {
+    printf("\n== Running multithreaded stress tests ==\n");
+
+    pthread_t threads[NUM_THREADS];
+    for (long i = 0; i < NUM_THREADS; i++) {
+        pthread_create(&threads[i], NULL, worker, (void*)i);
+    }
+    long corrupted = 0;
+    for (int i = 0; i < NUM_THREADS; i++) {
+        void* result;
+        pthread_join(threads[i], &result);
+        corrupted += (long)result;
+    }
+    print_test_result(corrupted == 0, "No block overwritten by another one");
+
+    long live = 0;
+    bool all_intact = true;
+    for (int i = 0; i < NUM_SLOTS; i++) {
+        if (!slots[i]) continue;
+        live += ConcurrentBuddy_usableSize(&buddy, slots[i]) + 16;
+        all_intact = all_intact && intact(slots[i]);
+    }
+    print_test_result(all_intact, "Live blocks intact");
+    print_test_result(ConcurrentBuddy_check(&buddy) == live, "Tree consistent with the live blocks after millions of operations");
+
+    for (int i = 0; i < NUM_SLOTS; i++) {
+        if (slots[i]) ConcurrentBuddy_free(&buddy, slots[i]);
+        slots[i] = NULL;
+    }
+    print_test_result(ConcurrentBuddy_check(&buddy) == 0, "Tree consistent and empty after the frees");
+    void* whole = ConcurrentBuddy_malloc(&buddy, MEMORY_SIZE - 16);
+    print_test_result(whole != NULL, "Whole memory merged back");
+    ConcurrentBuddy_free(&buddy, whole);
+
+    printf("== Multithreaded stress tests completed ==\n");
+}
+
+void print_final_results() {
+    printf("\n========== TEST RESULTS ==========\n");
+    printf("Total tests run: %d\n", test_result.total_tests);
+    printf("Passed tests: %d\n", test_result.passed_tests);
+    printf("Failed tests: %d\n", test_result.total_tests - test_result.passed_tests);
+    printf("==================================\n");
+}
+
+int main(int argc, char** argv) {
+    printf("Initializing Concurrent Buddy Allocator... ");
+    if (ConcurrentBuddy_init(&buddy, BUDDY_LEVELS, memory, MEMORY_SIZE, nodes, sizeof(nodes), MIN_BUCKET_SIZE) != 0) {
+        printf("Failed to initialize Concurrent Buddy Allocator\n");
+        return -1;
+    }
+    printf("DONE\n");
+
+    // Run tests
+    test_single_thread();
+    test_threads();
+
+    // Print final results
+    print_final_results();
+
+    return 0;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <stdio.h>
+
+// messages of the allocator, selected at compile time with PSEUDO_MALLOC_LOG_LEVEL:
+// the messages above the level are compiled out
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1 // invalid requests, double frees, out of memory
+#define LOG_LEVEL_INFO 2  // creation of the allocators
+#define LOG_LEVEL_TRACE 3 // every allocation and free
+
+// PSEUDO_MALLOC_NO_LOG disables all of them, as in the LD_PRELOAD library, where printf
+// could call malloc while the allocator is in use
+#ifdef PSEUDO_MALLOC_NO_LOG
+#undef PSEUDO_MALLOC_LOG_LEVEL
+#define PSEUDO_MALLOC_LOG_LEVEL LOG_LEVEL_NONE
+#elif !defined(PSEUDO_MALLOC_LOG_LEVEL)
+#define PSEUDO_MALLOC_LOG_LEVEL LOG_LEVEL_ERROR
+#endif
+
+// the arguments are still compiled (no unused variables), the branch is removed
+#define LOG_AT(level, ...) do { if (PSEUDO_MALLOC_LOG_LEVEL >= (level)) printf(__VA_ARGS__); } while (0)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_TRACE(...) LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
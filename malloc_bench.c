@@ -0,0 +1,333 @@
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Microbenchmarks of the arena allocator (Arena_malloc/Arena_free: buddy arenas and the
+// mmap path) against the malloc of the C library. Every workload runs in its own process
+// and reports the latency percentiles (ns/op, timed in batches of BATCH operations),
+// the peak RSS and the fragmentation: 1 - peak live bytes requested / peak RSS growth.
+// usage: ./malloc_bench [ops] [threads] [workload]
+// (results go to stderr, run with > /dev/null to hide the allocator log)
+
+#define BATCH 64          // operations timed together: the clock costs about as much as an operation
+#define CHURN_BLOCKS 1000 // blocks allocated before being freed by the LIFO/FIFO churn
+#define LARSON_SLOTS 1000 // blocks kept alive by each thread of larson
+#define LARSON_ROUNDS 10  // the slots of a thread go to the next one at every round
+#define MIX_SLOTS 256     // blocks kept alive by the threshold mix
+#define RING_SIZE 1024    // blocks in flight between a producer and its consumer
+
+typedef struct {
+    const char* name;
+    void* (*malloc)(size_t size);
+    void (*free)(void* ptr);
+} Backend;
+
+static void* pseudo_backend_malloc(size_t size) { return Arena_malloc(size); }
+static void pseudo_backend_free(void* ptr) { Arena_free(ptr); }
+
+Backend backends[] = {
+    {"pseudo", pseudo_backend_malloc, pseudo_backend_free},
+    {"glibc", malloc, free},
+};
+
+// latencies measured by a thread, and the live bytes it requested (the multithreaded
+// workloads, where blocks change thread, estimate the peak instead)
+typedef struct {
+    double* ns;      // ns/op of each batch
+    int count;
+    int capacity;
+    struct timespec start;
+    int in_batch;    // operations since start
+    long live;       // bytes requested and not freed yet
+    long peak_live;
+} Samples;
+
+int num_ops = 200000;
+int num_threads = 4;
+Backend* backend;
+
+static void samples_init(Samples* s, int ops) {
+    s->capacity = ops / BATCH + 1;
+    s->ns = malloc(s->capacity * sizeof(double));
+    s->count = 0;
+    s->in_batch = 0;
+    s->live = s->peak_live = 0;
+    clock_gettime(CLOCK_MONOTONIC, &s->start);
+}
+
+// counts an operation, closing the batch every BATCH of them
+static void tick(Samples* s) {
+    if (++s->in_batch < BATCH) return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (s->count < s->capacity) {
+        s->ns[s->count++] = ((now.tv_sec - s->start.tv_sec) * 1e9 + (now.tv_nsec - s->start.tv_nsec)) / BATCH;
+    }
+    s->in_batch = 0;
+    s->start = now;
+}
+
+static void* timed_malloc(Samples* s, size_t size) {
+    void* p = backend->malloc(size);
+    tick(s);
+    if (p) {
+        ((size_t*)p)[0] = size; // touch the block, and remember the size for the live bytes
+        s->live += size;
+        if (s->live > s->peak_live) s->peak_live = s->live;
+    }
+    return p;
+}
+
+static void timed_free(Samples* s, void* p) {
+    if (!p) return;
+    s->live -= ((size_t*)p)[0];
+    backend->free(p);
+    tick(s);
+}
+
+static size_t random_size(unsigned int* seed, size_t min, size_t max) {
+    return min + rand_r(seed) % (max - min + 1);
+}
+
+// ---- workloads: they fill the samples of each thread ----
+
+static size_t pair_size;
+
+static void pairs(Samples* s) {
+    for (int i = 0; i < num_ops / 2; i++) {
+        timed_free(s, timed_malloc(s, pair_size));
+    }
+}
+
+// allocates CHURN_BLOCKS blocks, then frees them in the reverse (LIFO) or same (FIFO) order
+static void churn(Samples* s, int lifo) {
+    void* blocks[CHURN_BLOCKS];
+    unsigned int seed = 1;
+    for (int done = 0; done < num_ops; done += 2 * CHURN_BLOCKS) {
+        for (int i = 0; i < CHURN_BLOCKS; i++) blocks[i] = timed_malloc(s, random_size(&seed, 16, 512));
+        for (int i = 0; i < CHURN_BLOCKS; i++) timed_free(s, blocks[lifo ? CHURN_BLOCKS - 1 - i : i]);
+    }
+}
+
+static void lifo(Samples* s) { churn(s, 1); }
+static void fifo(Samples* s) { churn(s, 0); }
+
+// random sizes around the threshold: the blocks move between the buddy arenas and mmap
+static void threshold_mix(Samples* s) {
+    void* slots[MIX_SLOTS] = {0};
+    unsigned int seed = 1;
+    for (int i = 0; i < num_ops / 2; i++) {
+        int slot = rand_r(&seed) % MIX_SLOTS;
+        timed_free(s, slots[slot]);
+        slots[slot] = timed_malloc(s, random_size(&seed, pseudo_malloc_threshold() / 2, 2 * pseudo_malloc_threshold()));
+    }
+    for (int i = 0; i < MIX_SLOTS; i++) timed_free(s, slots[i]);
+}
+
+// blocks passed from a producer thread, which allocates them, to a consumer thread, which frees them
+typedef struct {
+    void* blocks[RING_SIZE];
+    unsigned long head; // next block to consume
+    unsigned long tail; // next free position for the producer
+    size_t min_size, max_size;
+    Samples producer, consumer;
+} Ring;
+
+static void* producer(void* arg) {
+    Ring* ring = arg;
+    unsigned int seed = (unsigned int)(size_t)ring;
+    for (int i = 0; i < num_ops / 2; i++) {
+        void* p = timed_malloc(&ring->producer, random_size(&seed, ring->min_size, ring->max_size));
+        while (ring->tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == RING_SIZE) sched_yield(); // full
+        ring->blocks[ring->tail % RING_SIZE] = p;
+        __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void* consumer(void* arg) {
+    Ring* ring = arg;
+    for (int i = 0; i < num_ops / 2; i++) {
+        while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->head) sched_yield(); // empty
+        void* p = ring->blocks[ring->head % RING_SIZE];
+        __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+        timed_free(&ring->consumer, p);
+    }
+    return NULL;
+}
+
+// pairs of producer and consumer threads, the samples of all the threads are merged in s
+static void producers_consumers(Samples* s, int num_pairs, size_t min_size, size_t max_size) {
+    Ring* rings = calloc(num_pairs, sizeof(Ring));
+    pthread_t threads[2 * num_pairs];
+    for (int i = 0; i < num_pairs; i++) {
+        rings[i].min_size = min_size;
+        rings[i].max_size = max_size;
+        samples_init(&rings[i].producer, num_ops / 2);
+        samples_init(&rings[i].consumer, num_ops / 2);
+        pthread_create(&threads[2 * i], NULL, producer, &rings[i]);
+        pthread_create(&threads[2 * i + 1], NULL, consumer, &rings[i]);
+    }
+    for (int i = 0; i < 2 * num_pairs; i++) pthread_join(threads[i], NULL);
+    for (int i = 0; i < num_pairs; i++) {
+        Samples* parts[] = {&rings[i].producer, &rings[i].consumer};
+        for (int j = 0; j < 2; j++) {
+            for (int k = 0; k < parts[j]->count && s->count < s->capacity; k++) s->ns[s->count++] = parts[j]->ns[k];
+            free(parts[j]->ns);
+        }
+        s->peak_live += RING_SIZE * (min_size + max_size) / 2; // the ring full of blocks of average size
+    }
+    free(rings);
+}
+
+// random sizes from 16 bytes to 16 KB, one producer and one consumer
+static void prodcons(Samples* s) { producers_consumers(s, 1, 16, 16384); }
+
+// xmalloc: small blocks always freed by another thread
+static void xmalloc(Samples* s) { producers_consumers(s, num_threads / 2 > 0 ? num_threads / 2 : 1, 16, 256); }
+
+// larson: every thread replaces random blocks of its slots, then gives the slots to the
+// next thread, which frees blocks allocated elsewhere
+typedef struct {
+    void** slots;
+    unsigned int seed;
+    int ops;
+    Samples samples;
+} LarsonThread;
+
+static void* larson_worker(void* arg) {
+    LarsonThread* t = arg;
+    for (int i = 0; i < t->ops / 2; i++) {
+        int slot = rand_r(&t->seed) % LARSON_SLOTS;
+        timed_free(&t->samples, t->slots[slot]);
+        t->slots[slot] = timed_malloc(&t->samples, random_size(&t->seed, 16, 512));
+    }
+    return NULL;
+}
+
+static void larson(Samples* s) {
+    void** slots = calloc((size_t)num_threads * LARSON_SLOTS, sizeof(void*));
+    LarsonThread* t = calloc(num_threads, sizeof(LarsonThread));
+    pthread_t threads[num_threads];
+    for (int i = 0; i < num_threads; i++) {
+        t[i].seed = i + 1;
+        t[i].ops = num_ops / num_threads / LARSON_ROUNDS;
+        samples_init(&t[i].samples, num_ops / num_threads);
+    }
+    for (int round = 0; round < LARSON_ROUNDS; round++) {
+        for (int i = 0; i < num_threads; i++) {
+            t[i].slots = slots + (size_t)((i + round) % num_threads) * LARSON_SLOTS;
+            pthread_create(&threads[i], NULL, larson_worker, &t[i]);
+        }
+        for (int i = 0; i < num_threads; i++) pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < num_threads; i++) {
+        for (int k = 0; k < t[i].samples.count && s->count < s->capacity; k++) s->ns[s->count++] = t[i].samples.ns[k];
+        free(t[i].samples.ns);
+    }
+    s->peak_live = (long)num_threads * LARSON_SLOTS * (16 + 512) / 2; // slots full of blocks of average size
+    for (int i = 0; i < num_threads * LARSON_SLOTS; i++) if (slots[i]) backend->free(slots[i]);
+    free(slots);
+    free(t);
+}
+
+// ---- harness ----
+
+typedef struct {
+    const char* name;
+    void (*run)(Samples* s);
+    size_t size; // for the alloc/free pairs
+} Workload;
+
+Workload workloads[] = {
+    {"pairs-16", pairs, 16},
+    {"pairs-64", pairs, 64},
+    {"pairs-256", pairs, 256},
+    {"pairs-1000", pairs, 1000},
+    {"pairs-4096", pairs, 4096},
+    {"pairs-65536", pairs, 65536},
+    {"lifo", lifo, 0},
+    {"fifo", fifo, 0},
+    {"threshold-mix", threshold_mix, 0},
+    {"prodcons", prodcons, 0},
+    {"xmalloc", xmalloc, 0},
+    {"larson", larson, 0},
+};
+
+// VmRSS or VmHWM of the process, in KB
+static long status_kb(const char* field) {
+    FILE* f = fopen("/proc/self/status", "r");
+    char line[256];
+    long kb = 0;
+    int len = strlen(field);
+    while (f && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, field, len) == 0) {
+            kb = atol(line + len + 1);
+            break;
+        }
+    }
+    if (f) fclose(f);
+    return kb;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(Samples* s, double p) {
+    if (s->count == 0) return 0;
+    return s->ns[(int)(p * (s->count - 1))];
+}
+
+// runs a workload in a child process, so that every run starts from a new heap
+static void run(Workload* w, Backend* b) {
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        backend = b;
+        pair_size = w->size;
+        Samples s;
+        samples_init(&s, 2 * num_ops);
+        long base_kb = status_kb("VmRSS:");
+        w->run(&s);
+        long rss_kb = status_kb("VmHWM:") - base_kb;
+        qsort(s.ns, s.count, sizeof(double), compare_double);
+        double fragmentation = rss_kb > 0 ? 1 - (double)s.peak_live / (rss_kb * 1024.0) : 0;
+        fprintf(stderr, "%-14s %-7s %9.1f %9.1f %9.1f %9.1f %10ld %7.2f\n", w->name, b->name,
+                percentile(&s, 0.5), percentile(&s, 0.9), percentile(&s, 0.99), percentile(&s, 1),
+                rss_kb, fragmentation < 0 ? 0 : fragmentation);
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%-14s %-7s failed\n", w->name, b->name);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) num_ops = atoi(argv[1]);
+    if (argc > 2) num_threads = atoi(argv[2]);
+    const char* only = argc > 3 ? argv[3] : NULL;
+    if (num_ops <= 0 || num_threads <= 0) {
+        fprintf(stderr, "usage: %s [ops] [threads] [workload]\n", argv[0]);
+        return -1;
+    }
+
+    fprintf(stderr, "%-14s %-7s %9s %9s %9s %9s %10s %7s\n", "workload", "malloc",
+            "p50 ns", "p90 ns", "p99 ns", "max ns", "rss KB", "frag");
+    for (int i = 0; i < (int)(sizeof(workloads) / sizeof(workloads[0])); i++) {
+        if (only && strcmp(only, workloads[i].name) != 0) continue;
+        for (int j = 0; j < (int)(sizeof(backends) / sizeof(backends[0])); j++) {
+            run(&workloads[i], &backends[j]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "arena.h"
+#include "trace.h"
+#include "profile.h"
+
+// Interposes the malloc family of the C library, to run unmodified programs on
+// top of the allocator: LD_PRELOAD=./libpseudomalloc.so program
+// Small requests go to the buddy arenas, which are mapped on the first use and
+// need neither stdio nor the libc malloc to be initialized; large ones to mmap.
+// With PSEUDO_MALLOC_TRACE=file the allocations are recorded in file (trace.h), with
+// PSEUDO_MALLOC_PURGE_MS=n the free pages of the arenas go back to the OS once they
+// stay unused for n to 2n ms (Arena_startPurger). With PSEUDO_MALLOC_PROFILE=file a heap
+// profile is sampled every PSEUDO_MALLOC_PROFILE_RATE bytes (profile.h) and written at exit.
+// PSEUDO_MALLOC_HUGEPAGES=thp or hugetlb backs the next arenas and the large mappings with
+// huge pages (Arena_setBacking). PSEUDO_MALLOC_THRESHOLD=n sets the cutoff between the
+// arenas and mmap, PSEUDO_MALLOC_THRESHOLD=adaptive lets it follow the workload.
+
+// no object can be larger than PTRDIFF_MAX (with room for the header and page rounding)
+static int valid_size(size_t size){
+    if (size > PTRDIFF_MAX - 2 * (size_t)sysconf(_SC_PAGESIZE)){
+        errno = ENOMEM;
+        return 0;
+    }
+    return 1;
+}
+
+void* malloc(size_t size){
+    if (!valid_size(size)) return NULL;
+    void* p = Arena_malloc(size ? size : 1); // a unique pointer for 0 bytes too
+    if (!p) errno = ENOMEM;
+    else TRACE(TRACE_MALLOC, p, NULL, size);
+    return p;
+}
+
+void free(void* ptr){
+    if (!ptr) return;
+    TRACE(TRACE_FREE, ptr, NULL, 0); // before the address can be reused by another thread
+    Arena_free(ptr);
+}
+
+void* calloc(size_t nmemb, size_t size){
+    if (size && nmemb > SIZE_MAX / size){
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t total = nmemb * size;
+    if (!valid_size(total)) return NULL;
+    if (total >= pseudo_malloc_threshold()){ // new mappings are already zero
+        void* p = pseudo_calloc(NULL, 1, total);
+        if (!p) errno = ENOMEM;
+        else TRACE(TRACE_MALLOC, p, NULL, total);
+        return p;
+    }
+    void* p = malloc(total);
+    if (p) memset(p, 0, total);
+    return p;
+}
+
+void* realloc(void* ptr, size_t size){
+    if (!valid_size(size)) return NULL;
+    if (ptr && size == 0){
+        free(ptr);
+        return NULL;
+    }
+    // timed before the old block can be reused by another thread, like free: the new id is known after
+    int traced = __atomic_load_n(&trace_enabled, __ATOMIC_RELAXED);
+    uint64_t time = traced ? Trace_time() : 0;
+    void* p = Arena_realloc(ptr, size ? size : 1);
+    if (!p) errno = ENOMEM;
+    else if (traced) Trace_eventAt(TRACE_REALLOC, p, ptr, size, time);
+    return p;
+}
+
+void* memalign(size_t alignment, size_t size){
+    if (alignment == 0 || (alignment & (alignment - 1)) || alignment > PTRDIFF_MAX / 2){
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!valid_size(size) || !valid_size(size + alignment)) return NULL;
+    void* p = Arena_mallocAligned(size ? size : 1, alignment);
+    if (!p) errno = ENOMEM;
+    else TRACE(TRACE_MALLOC, p, NULL, size);
+    return p;
+}
+
+void* aligned_alloc(size_t alignment, size_t size){
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size){
+    if (alignment % sizeof(void*) || (alignment & (alignment - 1)) || alignment > PTRDIFF_MAX / 2){
+        return EINVAL;
+    }
+    int saved_errno = errno; // posix_memalign does not set errno
+    void* p = memalign(alignment, size);
+    errno = saved_errno;
+    if (!p) return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+void* valloc(size_t size){
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+void* pvalloc(size_t size){
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    return memalign(page_size, (size + page_size - 1) / page_size * page_size);
+}
+
+size_t malloc_usable_size(void* ptr){
+    return ptr ? Arena_usableSize(ptr) : 0;
+}
+
+// the padding to keep is ignored: the arenas keep the first page of their free blocks anyway
+int malloc_trim(size_t pad){
+    return Arena_trim() > 0;
+}
+
+// fork with all the allocator locks taken, so that the child finds no lock held by
+// a thread that does not exist any more
+static void fork_prepare(void){
+    Profile_lock();
+    Trace_lock();
+    Arena_lockAll();
+    MmapCache_lock();
+}
+
+static void fork_parent(void){
+    MmapCache_unlock();
+    Arena_unlockAll();
+    Trace_unlock();
+    Profile_unlock();
+}
+
+// the other threads are gone: their flushes and the purger too
+static void fork_child(void){
+    MmapCache_unlock();
+    Arena_forkChild();
+    Trace_forkChild();
+    Profile_unlock();
+}
+
+__attribute__((constructor))
+static void preload_init(void){
+    pthread_atfork(fork_prepare, fork_parent, fork_child);
+    const char* trace_path = getenv("PSEUDO_MALLOC_TRACE");
+    if (trace_path) Trace_start(trace_path);
+    const char* huge_pages = getenv("PSEUDO_MALLOC_HUGEPAGES");
+    if (huge_pages){
+        Arena_setBacking(strcmp(huge_pages, "hugetlb") == 0 ? ARENA_HUGETLB : ARENA_THP);
+        MmapCache_setHugePages(1);
+    }
+    const char* threshold = getenv("PSEUDO_MALLOC_THRESHOLD");
+    if (threshold){
+        if (strcmp(threshold, "adaptive") == 0) pseudo_malloc_set_adaptive(1);
+        else pseudo_malloc_set_threshold(atoi(threshold));
+    }
+    const char* purge_ms = getenv("PSEUDO_MALLOC_PURGE_MS");
+    if (purge_ms) Arena_startPurger(atoi(purge_ms));
+    if (getenv("PSEUDO_MALLOC_PROFILE")){
+        const char* rate = getenv("PSEUDO_MALLOC_PROFILE_RATE");
+        Profile_start(rate ? atol(rate) : 0);
+    }
+}
+
+__attribute__((destructor))
+static void preload_fini(void){
+    Trace_stop();
+    const char* profile_path = getenv("PSEUDO_MALLOC_PROFILE");
+    if (profile_path){
+        Profile_dump(profile_path);
+        Profile_stop();
+    }
+}
@@ -0,0 +1,168 @@
+#define _GNU_SOURCE // for RTLD_DEFAULT
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+// Runs itself with LD_PRELOAD=./libpseudomalloc.so: every malloc of the program,
+// stdio included, goes to the allocator.
+
+#define PRELOAD_LIBRARY "./libpseudomalloc.so"
+#define NUM_THREADS 4
+
+typedef struct {
+    int total_tests;
+    int passed_tests;
+} TestResult;
+
+TestResult test_result = {0, 0};
+
+void print_test_result(bool passed, const char* description) {
+    test_result.total_tests++;
+    if (passed) {
+        test_result.passed_tests++;
+        printf("[SUCCESS] %s\n", description);
+    } else {
+        printf("[ERROR] %s\n", description);
+    }
+}
+
+void test_interposition() {
+    printf("\n== Running interposition tests ==\n");
+
+    int (*arena_count)(void) = (int (*)(void))dlsym(RTLD_DEFAULT, "Arena_count");
+    print_test_result(arena_count != NULL, "malloc comes from libpseudomalloc.so");
+
+    char* s = strdup("pseudo malloc");
+    print_test_result(s != NULL && strcmp(s, "pseudo malloc") == 0, "strdup uses the interposed malloc");
+    free(s);
+    print_test_result(arena_count && arena_count() > 0, "A buddy arena was mapped on the first use");
+
+    printf("== Interposition tests completed ==\n");
+}
+
+void test_malloc_family() {
+    printf("\n== Running malloc family tests ==\n");
+
+    char* p = malloc(100);
+    memset(p, 'a', 100);
+    p = realloc(p, 5000); // from the buddy arena to mmap
+    bool kept = p != NULL;
+    for (int i = 0; kept && i < 100; i++) kept = p[i] == 'a';
+    print_test_result(kept, "realloc from 100 to 5000 bytes keeps the content");
+    print_test_result(malloc_usable_size(p) >= 5000, "malloc_usable_size covers the request");
+    free(p);
+
+    int* zeros = calloc(1000, sizeof(int));
+    bool zeroed = zeros != NULL;
+    for (int i = 0; zeroed && i < 1000; i++) zeroed = zeros[i] == 0;
+    print_test_result(zeroed, "calloc returns zeroed memory");
+    free(zeros);
+
+    void* aligned;
+    print_test_result(posix_memalign(&aligned, 64, 200) == 0 && (size_t)aligned % 64 == 0, "posix_memalign 200 bytes aligned to 64");
+    free(aligned);
+    aligned = memalign(4096, 300);
+    print_test_result(aligned != NULL && (size_t)aligned % 4096 == 0, "memalign 300 bytes aligned to 4096");
+    free(aligned);
+
+    void* empty = malloc(0);
+    print_test_result(empty != NULL, "malloc(0) returns a unique pointer");
+    free(empty);
+    free(NULL);
+
+    printf("== Malloc family tests completed ==\n");
+}
+
+void* thread_worker(void* arg) {
+    long errors = 0;
+    for (int i = 0; i < 10000; i++) {
+        size_t size = 1 + (i * 37) % 3000;
+        unsigned char* p = malloc(size);
+        if (!p) { errors++; continue; }
+        memset(p, (int)(size_t)arg, size);
+        if (p[size - 1] != (unsigned char)(size_t)arg) errors++;
+        free(p);
+    }
+    return (void*)errors;
+}
+
+void test_threads_and_fork() {
+    printf("\n== Running threads and fork tests ==\n");
+
+    pthread_t threads[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        pthread_create(&threads[i], NULL, thread_worker, (void*)(size_t)(i + 1));
+    }
+    long errors = 0;
+    for (int i = 0; i < NUM_THREADS; i++) {
+        void* ret;
+        pthread_join(threads[i], &ret);
+        errors += (long)ret;
+    }
+    print_test_result(errors == 0, "Threads allocate and free concurrently");
+
+    pid_t pid = fork();
+    if (pid == 0) { // the child must be able to allocate
+        void* p = malloc(100);
+        void* q = malloc(10000);
+        free(p);
+        free(q);
+        _exit(p && q ? 0 : 1);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    print_test_result(WIFEXITED(status) && WEXITSTATUS(status) == 0, "The child of a fork can allocate");
+
+    // the purger thread is not copied: the child can start its own
+    int (*start_purger)(int) = (int (*)(int))dlsym(RTLD_DEFAULT, "Arena_startPurger");
+    void (*stop_purger)(void) = (void (*)(void))dlsym(RTLD_DEFAULT, "Arena_stopPurger");
+    bool started = start_purger && stop_purger && start_purger(10) == 0;
+    pid = fork();
+    if (pid == 0) {
+        alarm(5);
+        int restarted = start_purger(10) == 0;
+        void* p = malloc(100);
+        stop_purger();
+        free(p);
+        _exit(restarted && p ? 0 : 1);
+    }
+    waitpid(pid, &status, 0);
+    if (started) stop_purger();
+    print_test_result(started && WIFEXITED(status) && WEXITSTATUS(status) == 0, "The child of a fork does not inherit the purger");
+
+    printf("== Threads and fork tests completed ==\n");
+}
+
+void print_final_results() {
+    printf("\n========== TEST RESULTS ==========\n");
+    printf("Total tests run: %d\n", test_result.total_tests);
+    printf("Passed tests: %d\n", test_result.passed_tests);
+    printf("Failed tests: %d\n", test_result.total_tests - test_result.passed_tests);
+    printf("==================================\n");
+}
+
+int main(int argc, char** argv) {
+    const char* preload = getenv("LD_PRELOAD");
+    if (!preload || !strstr(preload, "libpseudomalloc.so")) {
+        setenv("LD_PRELOAD", PRELOAD_LIBRARY, 1);
+        execv(argv[0], argv);
+        perror("execv");
+        return -1;
+    }
+
+    // Run tests
+    test_interposition();
+    test_malloc_family();
+    test_threads_and_fork();
+
+    // Print final results
+    print_final_results();
+
+    return 0;
+}
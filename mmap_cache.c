@@ -0,0 +1,175 @@
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "mmap_cache.h"
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static MmapCacheItem* buckets[MMAP_CACHE_BUCKETS];
+static MmapCacheItem* newest;
+static MmapCacheItem* oldest;
+static size_t max_bytes = MMAP_CACHE_MAX_BYTES;
+static int max_age_ms = MMAP_CACHE_MAX_AGE_MS;
+static MmapCacheStats stats;
+static int huge_pages;
+
+static size_t page_size(void){
+    static size_t size;
+    if (!size) size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+static long long now_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts); // no syscall, a tick of precision is enough
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static int bucket_of(size_t pages){
+    int bucket = 63 - __builtin_clzll(pages); // floor(log2(pages))
+    return bucket < MMAP_CACHE_BUCKETS ? bucket : MMAP_CACHE_BUCKETS - 1;
+}
+
+// gives back pages to the OS keeping them mapped, lazily when the kernel supports it
+static void release_pages(char* start, size_t length){
+    if (length == 0) return;
+#ifdef MADV_FREE
+    if (madvise(start, length, MADV_FREE) == 0) return;
+#endif
+    madvise(start, length, MADV_DONTNEED);
+}
+
+// detaches a region from both lists (lock held)
+static void remove_item(MmapCacheItem* item){
+    int bucket = bucket_of(item->mapping_size / page_size());
+    if (item->prev) item->prev->next = item->next;
+    else buckets[bucket] = item->next;
+    if (item->next) item->next->prev = item->prev;
+
+    if (item->newer) item->newer->older = item->older;
+    else newest = item->older;
+    if (item->older) item->older->newer = item->newer;
+    else oldest = item->newer;
+
+    stats.cached_regions--;
+    stats.cached_bytes -= item->mapping_size;
+    stats.resident_bytes -= item->resident_size;
+}
+
+// unmaps the oldest regions while they are too old or the cache is too large (lock held)
+static void evict(void){
+    long long limit = now_ms() - max_age_ms;
+    while (oldest && (stats.cached_bytes > max_bytes || oldest->time_ms < limit)){
+        MmapCacheItem* item = oldest;
+        remove_item(item);
+        munmap(item, item->mapping_size);
+    }
+}
+
+void MmapCache_config(size_t new_max_bytes, int new_max_age_ms){
+    pthread_mutex_lock(&cache_lock);
+    max_bytes = new_max_bytes;
+    max_age_ms = new_max_age_ms;
+    evict();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void MmapCache_setHugePages(int enabled){
+    huge_pages = enabled;
+}
+
+void* MmapCache_map(size_t size, size_t* mapping_size, int* fresh){
+    size_t pages = (size + page_size() - 1) / page_size();
+    int bucket = bucket_of(pages);
+    MmapCacheItem* found = NULL;
+
+    pthread_mutex_lock(&cache_lock);
+    evict();
+    // a region of the same bucket large enough, or of the next one at most twice the size
+    for (MmapCacheItem* item = buckets[bucket]; item && !found; item = item->next){
+        if (item->mapping_size >= pages * page_size()) found = item;
+    }
+    if (!found && bucket + 1 < MMAP_CACHE_BUCKETS){
+        for (MmapCacheItem* item = buckets[bucket + 1]; item && !found; item = item->next){
+            if (item->mapping_size <= 2 * pages * page_size()) found = item;
+        }
+    }
+    if (found){
+        remove_item(found);
+        stats.hits++;
+    } else {
+        stats.misses++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    if (found){
+        *mapping_size = found->mapping_size;
+        *fresh = 0;
+        // the pages past the request stay mapped, but not in RAM
+        size_t used = pages * page_size();
+        if (found->resident_size > used){
+            release_pages((char*)found + used, found->resident_size - used);
+        }
+        return found;
+    }
+    void* region = mmap(NULL, pages * page_size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+    if (huge_pages && pages * page_size() >= HUGE_PAGE_SIZE) madvise(region, pages * page_size(), MADV_HUGEPAGE);
+#endif
+    *mapping_size = pages * page_size();
+    *fresh = 1;
+    return region;
+}
+
+void MmapCache_unmap(void* region, size_t mapping_size, size_t used_size){
+    pthread_mutex_lock(&cache_lock);
+    if (mapping_size > max_bytes || max_age_ms <= 0){ // would never fit
+        pthread_mutex_unlock(&cache_lock);
+        munmap(region, mapping_size);
+        return;
+    }
+    MmapCacheItem* item = (MmapCacheItem*)region;
+    int bucket = bucket_of(mapping_size / page_size());
+    item->mapping_size = mapping_size;
+    item->resident_size = (used_size + page_size() - 1) / page_size() * page_size();
+    item->time_ms = now_ms();
+    item->prev = NULL;
+    item->next = buckets[bucket];
+    if (item->next) item->next->prev = item;
+    buckets[bucket] = item;
+    item->newer = NULL;
+    item->older = newest;
+    if (newest) newest->newer = item;
+    else oldest = item;
+    newest = item;
+    stats.cached_regions++;
+    stats.cached_bytes += mapping_size;
+    stats.resident_bytes += item->resident_size;
+    evict(); // the oldest regions make room for the new one
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void MmapCache_flush(void){
+    pthread_mutex_lock(&cache_lock);
+    while (oldest){
+        MmapCacheItem* item = oldest;
+        remove_item(item);
+        munmap(item, item->mapping_size);
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void MmapCache_stats(MmapCacheStats* out){
+    pthread_mutex_lock(&cache_lock);
+    *out = stats;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void MmapCache_lock(void){
+    pthread_mutex_lock(&cache_lock);
+}
+
+void MmapCache_unlock(void){
+    pthread_mutex_unlock(&cache_lock);
+}
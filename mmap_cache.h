@@ -0,0 +1,52 @@
+#pragma once
+#include <stddef.h>
+
+#define MMAP_CACHE_BUCKETS 16                    // bucket k keeps regions of [2^k, 2^(k+1)) pages
+#define MMAP_CACHE_MAX_BYTES (4 * 1024 * 1024)   // default limit of the bytes kept in the cache
+#define MMAP_CACHE_MAX_AGE_MS 1000               // default time a region stays in the cache
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)         // transparent huge pages of x86-64 and arm64
+
+// Cache of the regions released by the mmap path of pseudo_free: instead of an
+// munmap/mmap pair, a released region is kept and given to the next large request
+// of about the same size. The cached regions live in a list by age and in one per bucket.
+typedef struct MmapCacheItem {
+    struct MmapCacheItem* next;   // regions of the same bucket
+    struct MmapCacheItem* prev;
+    struct MmapCacheItem* older;  // all the regions, from the newest to the oldest
+    struct MmapCacheItem* newer;
+    size_t mapping_size;          // length of the mapping
+    size_t resident_size;         // bytes that may still be backed by physical pages
+    long long time_ms;            // when it entered the cache
+} MmapCacheItem;
+
+typedef struct {
+    long hits;            // requests served by a cached region
+    long misses;          // requests that needed an mmap
+    int cached_regions;
+    size_t cached_bytes;  // length of the cached mappings
+    size_t resident_bytes;// part of them possibly still in RAM
+} MmapCacheStats;
+
+// sets the limits of the cache (max_bytes 0 disables it), evicting what exceeds them
+void MmapCache_config(size_t max_bytes, int max_age_ms);
+
+// new mappings of at least HUGE_PAGE_SIZE bytes are advised to use transparent huge pages
+// (madvise MADV_HUGEPAGE, ignored where the kernel does not support them)
+void MmapCache_setHugePages(int enabled);
+
+// maps at least size bytes, reusing a cached region when possible: the length of the
+// mapping is returned in mapping_size, the pages beyond size are released if it is larger.
+// fresh is set to 1 for a new mapping (its pages are zero), 0 for a reused one
+void* MmapCache_map(size_t size, size_t* mapping_size, int* fresh);
+
+// releases a mapping of which used_size bytes were used: it is cached if the limits allow, unmapped otherwise
+void MmapCache_unmap(void* region, size_t mapping_size, size_t used_size);
+
+// unmaps all the cached regions
+void MmapCache_flush(void);
+
+void MmapCache_stats(MmapCacheStats* stats);
+
+// take and release the lock of the cache, to fork in a consistent state
+void MmapCache_lock(void);
+void MmapCache_unlock(void);
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "persistent_heap.h"
+#include "log.h"
+#include "stats.h"
+
+static size_t page_size(void){
+    static size_t size;
+    if (!size) size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+static size_t round_page(size_t bytes){
+    return (bytes + page_size() - 1) / page_size() * page_size();
+}
+
+// FNV-1a, 64 bits
+static uint64_t hash(uint64_t h, const void* data, size_t length){
+    const uint8_t* bytes = data;
+    for (size_t i = 0; i < length; i++){
+        h ^= bytes[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t checksum(PersistentHeapHeader* header, const char* bitmap){
+    uint64_t h = hash(0xcbf29ce484222325ULL, header, offsetof(PersistentHeapHeader, checksum));
+    return hash(h, bitmap, header->bitmap_size);
+}
+
+// the first change after a checkpoint reaches the file as "not clean" before the allocator
+// touches the bitmap or the free lists, so a crash in between is detected at open
+static int PersistentHeap_touch(PersistentHeap* heap){
+    if (!heap->header->clean) return 0;
+    heap->header->clean = 0;
+    if (msync(heap->base, page_size(), MS_SYNC) != 0){
+        LOG_ERROR("Persistent heap error: msync failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// walks the free lists of the state just loaded: every block must be free in the bitmap,
+// on its own level, under a split parent and linked back to the previous one
+static int PersistentHeap_checkLists(BuddyAllocator* alloc){
+    for (int level = 0; level <= alloc->num_levels; level++){
+        int first = (1 << level) - 1;
+        size_t block_size = alloc->min_bucket_size << (alloc->num_levels - level);
+        int prev = -1;
+        int steps = 0;
+        for (int idx = alloc->free_list[level]; idx != -1; steps++){
+            if (idx < first || idx >= 2 * first + 1 || steps > first + 1
+                || BuddyAllocator_bit(alloc, idx) || (idx && !BuddyAllocator_bit(alloc, (idx - 1) / 2))){
+                LOG_ERROR("Persistent heap error: invalid free block %d on level %d\n", idx, level);
+                return -1;
+            }
+            BuddyListItem* item = (BuddyListItem*)(alloc->memory + (size_t)(idx - first) * block_size);
+            if (item->prev != prev){
+                LOG_ERROR("Persistent heap error: broken free list on level %d\n", level);
+                return -1;
+            }
+            prev = idx;
+            idx = item->next;
+        }
+    }
+    return 0;
+}
+
+int PersistentHeap_create(PersistentHeap* heap, const char* path, int num_levels, size_t memory_size){
+    if (num_levels < 0 || num_levels >= MAX_LEVELS || memory_size == 0 || (memory_size & (memory_size - 1))){
+        LOG_ERROR("Persistent heap error: invalid geometry (%d levels, %zu bytes)\n", num_levels, memory_size);
+        return -1;
+    }
+    int bitmap_size = BitMap_getBytes((1 << (num_levels + 1)) - 1);
+    size_t memory_offset = round_page(page_size() + bitmap_size);
+    size_t file_size = memory_offset + memory_size;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0){
+        LOG_ERROR("Persistent heap error: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    // the file is sparse: the blocks take disk space once they are written
+    char* base = ftruncate(fd, file_size) == 0 ? mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (base == MAP_FAILED){
+        LOG_ERROR("Persistent heap error: cannot map %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    PersistentHeapHeader* header = (PersistentHeapHeader*)base;
+    header->magic = PERSISTENT_HEAP_MAGIC;
+    header->version = PERSISTENT_HEAP_VERSION;
+    header->state_size = sizeof(BuddyAllocator);
+    header->num_levels = num_levels;
+    header->bitmap_size = bitmap_size;
+    header->min_bucket_size = memory_size >> num_levels;
+    header->memory_size = memory_size;
+    header->bitmap_offset = page_size();
+    header->memory_offset = memory_offset;
+    header->root = 0;
+    if (BuddyAllocator_init(&heap->buddy, num_levels, base + memory_offset, memory_size,
+                            base + header->bitmap_offset, bitmap_size, header->min_bucket_size) != 0){
+        munmap(base, file_size);
+        close(fd);
+        return -1;
+    }
+    heap->header = header;
+    heap->base = base;
+    heap->file_size = file_size;
+    heap->fd = fd;
+    return PersistentHeap_checkpoint(heap);
+}
+
+int PersistentHeap_open(PersistentHeap* heap, const char* path){
+    int fd = open(path, O_RDWR);
+    if (fd < 0){
+        LOG_ERROR("Persistent heap error: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    char* base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= page_size()){
+        base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (base == MAP_FAILED){
+        LOG_ERROR("Persistent heap error: cannot map %s\n", path);
+        close(fd);
+        return -1;
+    }
+    PersistentHeapHeader* header = (PersistentHeapHeader*)base;
+    BuddyAllocator* state = &header->state;
+    int num_bits = header->num_levels >= 0 && header->num_levels < MAX_LEVELS ? (1 << (header->num_levels + 1)) - 1 : 0;
+    const char* error = NULL;
+    if (header->magic != PERSISTENT_HEAP_MAGIC || header->version != PERSISTENT_HEAP_VERSION
+        || header->state_size != sizeof(BuddyAllocator)){
+        error = "not a heap of this version";
+    } else if (!num_bits || header->memory_size == 0 || (header->memory_size & (header->memory_size - 1))
+               || header->min_bucket_size != header->memory_size >> header->num_levels
+               || header->bitmap_size != (uint32_t)BitMap_getBytes(num_bits)
+               || header->bitmap_offset != page_size()
+               || header->memory_offset != round_page(page_size() + header->bitmap_size)
+               || header->memory_offset + header->memory_size != (uint64_t)st.st_size){
+        error = "invalid geometry";
+    } else if (!header->clean){
+        error = "not closed after its last change";
+    } else if (header->checksum != checksum(header, base + header->bitmap_offset)){
+        error = "checksum mismatch";
+    } else if (state->num_levels != header->num_levels || state->memory_size != header->memory_size
+               || state->min_bucket_size != header->min_bucket_size || state->bitmap.num_bits != num_bits){
+        error = "allocator state of another geometry";
+    }
+    if (!error){
+        heap->buddy = *state;
+        BuddyAllocator_relocate(&heap->buddy, base + header->memory_offset, base + header->bitmap_offset);
+        if (PersistentHeap_checkLists(&heap->buddy) != 0) error = "corrupted free lists";
+    }
+    if (error){
+        LOG_ERROR("Persistent heap error: %s: %s\n", path, error);
+        munmap(base, st.st_size);
+        close(fd);
+        return -1;
+    }
+    heap->header = header;
+    heap->base = base;
+    heap->file_size = st.st_size;
+    heap->fd = fd;
+    // the blocks of the previous run count as allocated in this one
+    Stats_buddyResize(heap->buddy.used_bytes);
+    Stats_purge(heap->buddy.dirty_bytes, heap->buddy.purged_bytes);
+    LOG_INFO("Persistent heap %s opened: %zu bytes, %zu in use\n", path, heap->buddy.memory_size, heap->buddy.used_bytes);
+    return 0;
+}
+
+void* PersistentHeap_malloc(PersistentHeap* heap, size_t size){
+    if (PersistentHeap_touch(heap) != 0) return NULL;
+    return BuddyAllocator_malloc(&heap->buddy, size);
+}
+
+void PersistentHeap_free(PersistentHeap* heap, void* ptr){
+    if (!ptr){
+        LOG_ERROR("\nFree error: Memory to be freed is NULL\n");
+        return;
+    }
+    if (PersistentHeap_touch(heap) != 0) return;
+    BuddyAllocator_free(&heap->buddy, ptr);
+}
+
+uint64_t PersistentHeap_offset(PersistentHeap* heap, void* ptr){
+    if (!ptr) return 0;
+    return (char*)ptr - heap->buddy.memory;
+}
+
+void* PersistentHeap_pointer(PersistentHeap* heap, uint64_t offset){
+    if (!offset || offset >= heap->buddy.memory_size) return NULL;
+    return heap->buddy.memory + offset;
+}
+
+void PersistentHeap_setRoot(PersistentHeap* heap, void* ptr){
+    if (PersistentHeap_touch(heap) != 0) return;
+    heap->header->root = PersistentHeap_offset(heap, ptr);
+}
+
+void* PersistentHeap_root(PersistentHeap* heap){
+    return PersistentHeap_pointer(heap, heap->header->root);
+}
+
+int PersistentHeap_checkpoint(PersistentHeap* heap){
+    if (heap->buddy.order){
+        LOG_ERROR("Persistent heap error: the order table of the headerless mode is not in the file\n");
+        return -1;
+    }
+    if (heap->buddy.max_deferred) BuddyAllocator_coalesce(&heap->buddy); // the deferred blocks are not on the free lists
+    PersistentHeapHeader* header = heap->header;
+    header->state = heap->buddy;
+    header->state.memory = NULL; // the addresses of this run mean nothing to the next one
+    header->state.bitmap.buffer = NULL;
+    header->clean = 1;
+    header->checksum = checksum(header, heap->base + header->bitmap_offset);
+    if (msync(heap->base, heap->file_size, MS_SYNC) != 0){
+        LOG_ERROR("Persistent heap error: msync failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int PersistentHeap_close(PersistentHeap* heap){
+    int result = PersistentHeap_checkpoint(heap);
+    Stats_buddyResize(-(long long)heap->buddy.used_bytes);
+    Stats_purge(-(long long)heap->buddy.dirty_bytes, -(long long)heap->buddy.purged_bytes);
+    munmap(heap->base, heap->file_size);
+    close(heap->fd);
+    return result;
+}
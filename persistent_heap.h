@@ -0,0 +1,72 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "buddy_allocator.h"
+
+#define PERSISTENT_HEAP_MAGIC 0x504145484d50ULL // "PMHEAP"
+#define PERSISTENT_HEAP_VERSION 2
+
+// Buddy heap kept in a file: the header, the bitmap and the memory are one shared mapping,
+// so a restarted process maps the file again and finds its objects where it left them,
+// without rebuilding them. The allocator state is position independent (the free lists
+// and the block headers hold bitmap indexes): only the mapping address changes, so the
+// objects must link each other by offset (PersistentHeap_offset/PersistentHeap_pointer).
+//
+// The file is the live heap. PersistentHeap_checkpoint saves the state of the allocator in
+// the header with a checksum and flushes everything with msync; the first allocation or
+// free after it marks the header as not clean on disk before touching anything. A file
+// that was not closed or checkpointed after its last change (a crash) is refused at open.
+//
+// file:  | header (a page) | bitmap | memory (from a page boundary) |
+
+// first page of the file
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t state_size;      // sizeof(BuddyAllocator), its layout is part of the format
+    int32_t num_levels;
+    uint32_t bitmap_size;     // bytes of the bitmap
+    uint64_t min_bucket_size;
+    uint64_t memory_size;
+    uint64_t bitmap_offset;   // from the start of the file
+    uint64_t memory_offset;
+    uint64_t root;            // offset of the root object in the memory, 0 if not set
+    uint32_t clean;           // the state below matches the bitmap and the memory
+    uint32_t pad;
+    BuddyAllocator state;     // the allocator at the last checkpoint (its pointers are not used)
+    uint64_t checksum;        // FNV-1a of the header up to here and of the bitmap
+} PersistentHeapHeader;
+
+typedef struct {
+    BuddyAllocator buddy;
+    PersistentHeapHeader* header;
+    char* base;               // the mapping of the whole file
+    size_t file_size;
+    int fd;
+} PersistentHeap;
+
+// creates (or truncates) the file for a heap of memory_size bytes (a power of 2) split down
+// to num_levels levels, and maps it. Returns 0 on success, -1 on errors
+int PersistentHeap_create(PersistentHeap* heap, const char* path, int num_levels, size_t memory_size);
+
+// maps an existing heap, after checking its header (format, version, geometry, clean
+// shutdown, checksum) and the free lists. Returns 0 on success, -1 if it cannot be used
+int PersistentHeap_open(PersistentHeap* heap, const char* path);
+
+void* PersistentHeap_malloc(PersistentHeap* heap, size_t size);
+void PersistentHeap_free(PersistentHeap* heap, void* ptr);
+
+// offset of an object in the memory of the heap, valid across restarts, and back
+uint64_t PersistentHeap_offset(PersistentHeap* heap, void* ptr);
+void* PersistentHeap_pointer(PersistentHeap* heap, uint64_t offset);
+
+// object from which a restarted process finds the others (NULL clears it)
+void PersistentHeap_setRoot(PersistentHeap* heap, void* ptr);
+void* PersistentHeap_root(PersistentHeap* heap);
+
+// saves the allocator state with its checksum and writes the whole heap to the file
+// (msync), returns 0 on success, -1 on errors
+int PersistentHeap_checkpoint(PersistentHeap* heap);
+
+// checkpoints and unmaps the heap, returns the result of the checkpoint
+int PersistentHeap_close(PersistentHeap* heap);
@@ -0,0 +1,160 @@
+#include "persistent_heap.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define HEAP_FILE "persistent_heap_test.heap"
+#define HEAP_LEVELS 16
+#define HEAP_SIZE (4 * 1024 * 1024)
+#define NUM_NODES 1000
+
+// node of a list kept in the heap: linked by offset, as the heap moves between runs
+typedef struct {
+    uint64_t next;
+    int value;
+    char text[100];
+} Node;
+
+typedef struct {
+    int total_tests;
+    int passed_tests;
+} TestResult;
+
+TestResult test_result = {0, 0};
+
+void print_test_result(bool passed, const char* description) {
+    test_result.total_tests++;
+    if (passed) {
+        test_result.passed_tests++;
+        printf("[SUCCESS] %s\n", description);
+    } else {
+        printf("[ERROR] %s\n", description);
+    }
+}
+
+void test_restart() {
+    printf("\n== Running restart tests ==\n");
+
+    PersistentHeap heap;
+    print_test_result(PersistentHeap_create(&heap, HEAP_FILE, HEAP_LEVELS, HEAP_SIZE) == 0, "Heap of 4 MB created in a file");
+    Node* head = NULL;
+    for (int i = 0; i < NUM_NODES; i++) {
+        Node* node = PersistentHeap_malloc(&heap, sizeof(Node));
+        if (!node) break;
+        node->value = i;
+        sprintf(node->text, "node %d", i);
+        node->next = PersistentHeap_offset(&heap, head);
+        head = node;
+    }
+    PersistentHeap_setRoot(&heap, head);
+    void* scratch = PersistentHeap_malloc(&heap, 5000);
+    PersistentHeap_free(&heap, scratch);
+    size_t used = heap.buddy.used_bytes;
+    char* old_memory = heap.buddy.memory;
+    print_test_result(PersistentHeap_close(&heap) == 0, "Heap checkpointed and closed");
+
+    // a mapping where the heap was, so that the next one lands at another address
+    void* placeholder = mmap(old_memory, HEAP_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    print_test_result(PersistentHeap_open(&heap, HEAP_FILE) == 0, "Heap opened again");
+    print_test_result(heap.buddy.memory != old_memory && heap.buddy.used_bytes == used, "Heap moved to another address with the same blocks");
+    int count = 0;
+    bool intact = true;
+    char expected[100];
+    for (Node* node = PersistentHeap_root(&heap); node; node = PersistentHeap_pointer(&heap, node->next)) {
+        sprintf(expected, "node %d", NUM_NODES - 1 - count);
+        if (node->value != NUM_NODES - 1 - count || strcmp(node->text, expected) != 0) intact = false;
+        count++;
+    }
+    print_test_result(count == NUM_NODES && intact, "List found from the root after the restart");
+
+    // the allocator resumes: new blocks do not overlap the old ones, the old ones can be freed
+    Node* extra = PersistentHeap_malloc(&heap, sizeof(Node));
+    bool overlap = false;
+    for (Node* node = PersistentHeap_root(&heap); node; node = PersistentHeap_pointer(&heap, node->next)) {
+        if (node == extra) overlap = true;
+    }
+    print_test_result(extra && !overlap, "New block allocated among the old ones");
+    PersistentHeap_free(&heap, extra);
+    Node* node = PersistentHeap_root(&heap);
+    while (node) {
+        Node* next = PersistentHeap_pointer(&heap, node->next);
+        PersistentHeap_free(&heap, node);
+        node = next;
+    }
+    PersistentHeap_setRoot(&heap, NULL);
+    print_test_result(heap.buddy.used_bytes == 0 && PersistentHeap_malloc(&heap, HEAP_SIZE - sizeof(BuddyHeader)) != NULL,
+                      "Old blocks freed and merged back into the whole memory");
+    PersistentHeap_close(&heap);
+    if (placeholder != MAP_FAILED) munmap(placeholder, HEAP_SIZE);
+
+    printf("== Restart tests completed ==\n");
+}
+
+void test_validation() {
+    printf("\n== Running validation tests ==\n");
+
+    PersistentHeap heap;
+    PersistentHeap_create(&heap, HEAP_FILE, HEAP_LEVELS, HEAP_SIZE);
+    PersistentHeap_malloc(&heap, 100);
+    print_test_result(PersistentHeap_checkpoint(&heap) == 0 && heap.header->clean, "Checkpoint marks the heap clean");
+
+    // a change after the checkpoint, then a crash: the heap is not closed
+    PersistentHeap_malloc(&heap, 100);
+    print_test_result(!heap.header->clean, "First change after the checkpoint marks the heap not clean");
+    munmap(heap.base, heap.file_size);
+    close(heap.fd);
+    print_test_result(PersistentHeap_open(&heap, HEAP_FILE) == -1, "Heap not closed after its last change refused");
+
+    // a bit of the bitmap changed on disk
+    PersistentHeap_create(&heap, HEAP_FILE, HEAP_LEVELS, HEAP_SIZE);
+    PersistentHeap_malloc(&heap, 100);
+    PersistentHeap_close(&heap);
+    FILE* file = fopen(HEAP_FILE, "r+b");
+    fseek(file, sysconf(_SC_PAGESIZE) + 3, SEEK_SET);
+    fputc(0x5a, file);
+    fclose(file);
+    print_test_result(PersistentHeap_open(&heap, HEAP_FILE) == -1, "Heap with a corrupted bitmap refused");
+
+    // a free list link changed on disk: the second half of the memory is a free block
+    PersistentHeap_create(&heap, HEAP_FILE, HEAP_LEVELS, HEAP_SIZE);
+    PersistentHeap_malloc(&heap, 100);
+    long link = heap.header->memory_offset + HEAP_SIZE / 2;
+    PersistentHeap_close(&heap);
+    file = fopen(HEAP_FILE, "r+b");
+    fseek(file, link, SEEK_SET);
+    fputc(0x33, file);
+    fclose(file);
+    print_test_result(PersistentHeap_open(&heap, HEAP_FILE) == -1, "Heap with a corrupted free list refused");
+
+    // another format
+    file = fopen(HEAP_FILE, "r+b");
+    fputc('X', file);
+    fclose(file);
+    print_test_result(PersistentHeap_open(&heap, HEAP_FILE) == -1, "File with another magic number refused");
+    print_test_result(PersistentHeap_open(&heap, "missing.heap") == -1, "Missing file refused");
+    print_test_result(PersistentHeap_create(&heap, HEAP_FILE, HEAP_LEVELS, 3000) == -1, "Memory size not a power of 2 refused");
+
+    printf("== Validation tests completed ==\n");
+}
+
+void print_final_results() {
+    printf("\n========== TEST RESULTS ==========\n");
+    printf("Total tests run: %d\n", test_result.total_tests);
+    printf("Passed tests: %d\n", test_result.passed_tests);
+    printf("Failed tests: %d\n", test_result.total_tests - test_result.passed_tests);
+    printf("==================================\n");
+}
+
+int main(int argc, char** argv) {
+    // Run tests
+    test_restart();
+    test_validation();
+    unlink(HEAP_FILE);
+
+    // Print final results
+    print_final_results();
+
+    return 0;
+}
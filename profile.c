@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <sys/mman.h>
+#include "profile.h"
+#include "log.h"
+
+#define PROFILE_BUCKETS PROFILE_MAX_SAMPLES
+
+// a live sampled block
+typedef struct {
+    void* ptr;
+    size_t size;
+    int depth;
+    int next; // next sample of the bucket, or of the free list (-1 at the end)
+    void* stack[PROFILE_MAX_DEPTH];
+} ProfileSample;
+
+// hash table of the live samples by address, in mmapped memory
+typedef struct {
+    ProfileSample samples[PROFILE_MAX_SAMPLES];
+    int buckets[PROFILE_BUCKETS];
+    int counts[PROFILE_BUCKETS]; // samples per bucket: read without the lock, to skip most frees
+    int free_list;
+    long dropped;                // samples lost because the table was full
+} ProfileTable;
+
+int profile_enabled;
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER; // protects the table
+static ProfileTable* table;
+static long sample_bytes;
+static int epoch; // a new one at every start: the threads draw a new distance
+
+// per thread: bytes still to allocate before the next sample
+static __thread long countdown;
+static __thread int thread_epoch;
+static __thread uint64_t rng;
+static __thread int in_profiler; // backtrace can allocate: those allocations are not sampled
+
+static int bucket(void* ptr){
+    return ((uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL >> 48 & (PROFILE_BUCKETS - 1);
+}
+
+// exponentially distributed distance to the next sample, with mean sample_bytes
+static long next_distance(void){
+    if (!rng) rng = (uintptr_t)&rng ^ (uint64_t)time(NULL) * 0x9E3779B97F4A7C15ULL;
+    rng ^= rng << 13; // xorshift64
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    double u = ((rng >> 11) + 1) * (1.0 / 9007199254740992.0); // (0, 1]
+    return (long)(-log(u) * sample_bytes) + 1;
+}
+
+int Profile_start(long bytes){
+    pthread_mutex_lock(&profile_lock);
+    if (profile_enabled){
+        pthread_mutex_unlock(&profile_lock);
+        LOG_ERROR("Profile error: the profiler is running already\n");
+        return -1;
+    }
+    if (!table){
+        table = mmap(NULL, sizeof(ProfileTable), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (table == MAP_FAILED){
+            table = NULL;
+            pthread_mutex_unlock(&profile_lock);
+            LOG_ERROR("Profile error: mmap failed with error: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    memset(table->buckets, -1, sizeof(table->buckets));
+    memset(table->counts, 0, sizeof(table->counts));
+    for (int i = 0; i < PROFILE_MAX_SAMPLES; i++) table->samples[i].next = i + 1;
+    table->samples[PROFILE_MAX_SAMPLES - 1].next = -1;
+    table->free_list = 0;
+    table->dropped = 0;
+    sample_bytes = bytes > 0 ? bytes : PROFILE_SAMPLE_BYTES;
+    epoch++;
+    // the first backtrace loads the unwinder, which allocates: better before the first sample
+    void* stack[1];
+    in_profiler = 1;
+    backtrace(stack, 1);
+    in_profiler = 0;
+    __atomic_store_n(&profile_enabled, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&profile_lock);
+    return 0;
+}
+
+void Profile_stop(void){
+    pthread_mutex_lock(&profile_lock);
+    __atomic_store_n(&profile_enabled, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&profile_lock);
+}
+
+void Profile_alloc(void* ptr, size_t size){
+    if (in_profiler || !ptr) return;
+    if (thread_epoch != epoch){
+        thread_epoch = epoch;
+        countdown = next_distance();
+    }
+    countdown -= size;
+    if (countdown > 0) return;
+    countdown = next_distance();
+
+    void* stack[PROFILE_MAX_DEPTH + 1];
+    in_profiler = 1;
+    int depth = backtrace(stack, PROFILE_MAX_DEPTH + 1) - 1; // without this function
+    in_profiler = 0;
+
+    pthread_mutex_lock(&profile_lock);
+    if (!profile_enabled){
+        pthread_mutex_unlock(&profile_lock);
+        return;
+    }
+    int i = table->free_list;
+    if (i < 0){
+        table->dropped++;
+        pthread_mutex_unlock(&profile_lock);
+        return;
+    }
+    table->free_list = table->samples[i].next;
+    ProfileSample* sample = &table->samples[i];
+    sample->ptr = ptr;
+    sample->size = size;
+    sample->depth = depth > 0 ? depth : 0;
+    memcpy(sample->stack, stack + 1, sample->depth * sizeof(void*));
+    int b = bucket(ptr);
+    sample->next = table->buckets[b];
+    table->buckets[b] = i;
+    __atomic_store_n(&table->counts[b], table->counts[b] + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&profile_lock);
+}
+
+void Profile_free(void* ptr){
+    if (in_profiler || !ptr) return;
+    int b = bucket(ptr);
+    if (!__atomic_load_n(&table->counts[b], __ATOMIC_RELAXED)) return; // no sample can have this address
+    pthread_mutex_lock(&profile_lock);
+    for (int* i = &table->buckets[b]; *i != -1; i = &table->samples[*i].next){
+        ProfileSample* sample = &table->samples[*i];
+        if (sample->ptr == ptr){
+            int found = *i;
+            *i = sample->next;
+            sample->next = table->free_list;
+            table->free_list = found;
+            __atomic_store_n(&table->counts[b], table->counts[b] - 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+// bytes represented by a sample of size bytes: the small blocks are less likely to be sampled
+static double sample_weight(size_t size){
+    return size / (1 - exp(-(double)size / sample_bytes));
+}
+
+size_t Profile_liveBytes(void){
+    double bytes = 0;
+    pthread_mutex_lock(&profile_lock);
+    if (table){
+        for (int b = 0; b < PROFILE_BUCKETS; b++){
+            for (int i = table->buckets[b]; i != -1; i = table->samples[i].next){
+                bytes += sample_weight(table->samples[i].size);
+            }
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+    return (size_t)bytes;
+}
+
+static int compare_stack(const void* a, const void* b){
+    const ProfileSample* x = *(ProfileSample* const*)a;
+    const ProfileSample* y = *(ProfileSample* const*)b;
+    if (x->depth != y->depth) return x->depth - y->depth;
+    return memcmp(x->stack, y->stack, x->depth * sizeof(void*));
+}
+
+// writes a formatted line, returns -1 on errors
+static int write_line(int fd, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static int write_line(int fd, const char* format, ...){
+    char line[64 + PROFILE_MAX_DEPTH * 20];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length >= (int)sizeof(line)) length = sizeof(line) - 1;
+    return write(fd, line, length) == length ? 0 : -1;
+}
+
+// a group of samples with the same backtrace: count: bytes [count: bytes] @ addresses
+static int write_group(int fd, ProfileSample** group, int count){
+    size_t bytes = 0;
+    for (int i = 0; i < count; i++) bytes += group[i]->size;
+    char addresses[PROFILE_MAX_DEPTH * 20] = "";
+    int length = 0;
+    for (int i = 0; i < group[0]->depth; i++){
+        length += snprintf(addresses + length, sizeof(addresses) - length, " %p", group[0]->stack[i]);
+    }
+    return write_line(fd, "%d: %zu [%d: %zu] @%s\n", count, bytes, count, bytes, addresses);
+}
+
+int Profile_dump(const char* path){
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0){
+        LOG_ERROR("Profile error: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    // the live samples are copied, to sort them by backtrace without the lock
+    size_t copy_size = PROFILE_MAX_SAMPLES * (sizeof(ProfileSample) + sizeof(ProfileSample*));
+    ProfileSample* copy = mmap(NULL, copy_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (copy == MAP_FAILED){
+        LOG_ERROR("Profile error: mmap failed with error: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    ProfileSample** sorted = (ProfileSample**)(copy + PROFILE_MAX_SAMPLES);
+    int count = 0;
+    size_t bytes = 0;
+    pthread_mutex_lock(&profile_lock);
+    for (int b = 0; table && b < PROFILE_BUCKETS; b++){
+        for (int i = table->buckets[b]; i != -1; i = table->samples[i].next){
+            copy[count] = table->samples[i];
+            sorted[count] = &copy[count];
+            bytes += copy[count].size;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+    in_profiler = 1; // qsort may allocate
+    qsort(sorted, count, sizeof(ProfileSample*), compare_stack);
+    in_profiler = 0;
+
+    // pprof scales the samples back with the rate of heap_v2
+    int error = write_line(fd, "heap profile: %d: %zu [%d: %zu] @ heap_v2/%ld\n", count, bytes, count, bytes, sample_bytes);
+    for (int i = 1, first = 0; i <= count && !error; i++){
+        if (i == count || compare_stack(&sorted[i - 1], &sorted[i])){
+            error = write_group(fd, sorted + first, i - first);
+            first = i;
+        }
+    }
+    // the memory map, to find the symbols of the addresses
+    int maps = open("/proc/self/maps", O_RDONLY);
+    if (!error && maps >= 0){
+        error = write_line(fd, "\nMAPPED_LIBRARIES:\n");
+        char buffer[4096];
+        ssize_t length;
+        while (!error && (length = read(maps, buffer, sizeof(buffer))) > 0){
+            if (write(fd, buffer, length) != length) error = -1;
+        }
+    }
+    if (maps >= 0) close(maps);
+    munmap(copy, copy_size);
+    close(fd);
+    if (error){
+        LOG_ERROR("Profile error: cannot write %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+void Profile_lock(void){
+    pthread_mutex_lock(&profile_lock);
+}
+
+void Profile_unlock(void){
+    pthread_mutex_unlock(&profile_lock);
+}
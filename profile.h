@@ -0,0 +1,43 @@
+#pragma once
+#include <stddef.h>
+
+#define PROFILE_SAMPLE_BYTES (512 * 1024) // default mean distance between two samples
+#define PROFILE_MAX_SAMPLES (1 << 16)     // live samples kept, the next ones are dropped
+#define PROFILE_MAX_DEPTH 32              // frames of a backtrace
+
+// Sampling heap profiler: about one allocation every sample_bytes allocated bytes is
+// sampled (the distances are exponentially distributed, so every byte has the same chance),
+// its backtrace and size are kept until the block is freed. The live samples are written
+// in the legacy heap profile format of pprof: pprof --text program file
+// The allocators call PROFILE_ALLOC/PROFILE_FREE at their entry points: when the profiler
+// is off that is a single load. The recorder never calls malloc (its tables are mmapped),
+// so it can profile the LD_PRELOAD library: PSEUDO_MALLOC_PROFILE=file
+
+extern int profile_enabled; // set between Profile_start and Profile_stop
+
+#define PROFILE_ALLOC(ptr, size) \
+    do { if (__atomic_load_n(&profile_enabled, __ATOMIC_RELAXED)) Profile_alloc(ptr, size); } while (0)
+
+#define PROFILE_FREE(ptr) \
+    do { if (__atomic_load_n(&profile_enabled, __ATOMIC_RELAXED)) Profile_free(ptr); } while (0)
+
+// starts sampling with a mean distance of sample_bytes (<= 0 for PROFILE_SAMPLE_BYTES),
+// returns 0 on success
+int Profile_start(long sample_bytes);
+
+// stops sampling: the samples live at that moment stay for Profile_dump until the next start
+void Profile_stop(void);
+
+void Profile_alloc(void* ptr, size_t size);
+void Profile_free(void* ptr);
+
+// bytes of the live blocks estimated from the samples
+size_t Profile_liveBytes(void);
+
+// writes the live samples grouped by backtrace, with the memory map of the process for
+// the symbols: returns 0 on success, -1 on errors
+int Profile_dump(const char* path);
+
+// take and release the lock of the samples, to fork in a consistent state
+void Profile_lock(void);
+void Profile_unlock(void);
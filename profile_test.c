@@ -0,0 +1,116 @@
+#include "arena.h"
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PROFILE_FILE "profile_test.heap"
+#define SAMPLE_BYTES (64 * 1024)
+#define NUM_SMALL 2000 // blocks of 512 bytes, from the arenas
+#define NUM_LARGE 100  // blocks of 100000 bytes, mmapped
+
+typedef struct {
+    int total_tests;
+    int passed_tests;
+} TestResult;
+
+TestResult test_result = {0, 0};
+
+void print_test_result(bool passed, const char* description) {
+    test_result.total_tests++;
+    if (passed) {
+        test_result.passed_tests++;
+        printf("[SUCCESS] %s\n", description);
+    } else {
+        printf("[ERROR] %s\n", description);
+    }
+}
+
+static void* small[NUM_SMALL];
+static void* large[NUM_LARGE];
+
+// the allocation site of the profile
+__attribute__((noinline)) void allocate_blocks() {
+    for (int i = 0; i < NUM_SMALL; i++) small[i] = Arena_malloc(512);
+    for (int i = 0; i < NUM_LARGE; i++) large[i] = Arena_malloc(100000);
+}
+
+void free_blocks() {
+    for (int i = 0; i < NUM_SMALL; i++) Arena_free(small[i]);
+    for (int i = 0; i < NUM_LARGE; i++) Arena_free(large[i]);
+}
+
+void test_sampling() {
+    printf("\n== Running heap profiler tests ==\n");
+
+    allocate_blocks();
+    print_test_result(Profile_liveBytes() == 0, "Nothing sampled with the profiler off");
+    free_blocks();
+
+    print_test_result(Profile_start(SAMPLE_BYTES) == 0, "Profiler started");
+    print_test_result(Profile_start(SAMPLE_BYTES) == -1, "Correctly failed to start it twice");
+    allocate_blocks();
+    double live = NUM_SMALL * 512 + NUM_LARGE * 100000;
+    double estimate = Profile_liveBytes();
+    printf("live bytes: %.0f, estimated from the samples: %.0f\n", live, estimate);
+    print_test_result(estimate > 0.75 * live && estimate < 1.25 * live, "Live bytes estimated within 25%");
+
+    print_test_result(Profile_dump(PROFILE_FILE) == 0, "Profile written");
+    FILE* f = fopen(PROFILE_FILE, "r");
+    char line[1024];
+    bool header = f && fgets(line, sizeof(line), f) && strncmp(line, "heap profile: ", 14) == 0
+                  && strstr(line, "@ heap_v2/65536");
+    bool stacks = false, maps = false;
+    while (f && fgets(line, sizeof(line), f)) {
+        if (strstr(line, "] @ 0x")) stacks = true;
+        if (strcmp(line, "MAPPED_LIBRARIES:\n") == 0) maps = true;
+    }
+    if (f) fclose(f);
+    print_test_result(header, "Header in the heap_v2 format of pprof, with the sampling rate");
+    print_test_result(stacks, "Samples with their backtraces");
+    print_test_result(maps, "Memory map of the process for the symbols");
+    unlink(PROFILE_FILE);
+
+    free_blocks();
+    print_test_result(Profile_liveBytes() == 0, "Samples dropped when their blocks are freed");
+    Profile_stop();
+
+    printf("== Heap profiler tests completed ==\n");
+}
+
+void test_failed_realloc() {
+    printf("\n== Running failed realloc profiler tests ==\n");
+
+    Profile_start(1); // every block sampled
+    void* p = Arena_malloc(100000);
+    size_t before = Profile_liveBytes();
+    // larger than the address space: mremap fails and the block stays where it was
+    print_test_result(Arena_realloc(p, (size_t)1 << 50) == NULL, "Realloc beyond the address space failed");
+    print_test_result(before >= 100000 && Profile_liveBytes() == before, "Sample of the block kept after the failed realloc");
+    Arena_free(p);
+    print_test_result(Profile_liveBytes() == 0, "Sample dropped when the block is freed");
+    Profile_stop();
+
+    printf("== Failed realloc profiler tests completed ==\n");
+}
+
+void print_final_results() {
+    printf("\n========== TEST RESULTS ==========\n");
+    printf("Total tests run: %d\n", test_result.total_tests);
+    printf("Passed tests: %d\n", test_result.passed_tests);
+    printf("Failed tests: %d\n", test_result.total_tests - test_result.passed_tests);
+    printf("==================================\n");
+}
+
+int main(int argc, char** argv) {
+    // Run tests
+    test_sampling();
+    test_failed_realloc();
+
+    // Print final results
+    print_final_results();
+
+    return 0;
+}
@@ -1,63 +1,394 @@
+#define _GNU_SOURCE // for mremap
 #include <stdio.h>
 #include <assert.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
 #include "pseudo_malloc.h"
+#include "log.h"
+#include "stats.h"
+#include "profile.h"
 #include <sys/mman.h>
 #include <errno.h>
 #include <string.h>
 #include <bits/mman-linux.h>
 
-void* pseudo_malloc(BuddyAllocator* alloc, int size) {
-    if (size < 0) {
-        printf("\nMalloc error: Invalid Size (<0)\n");
+// header right before the user pointer of every mmapped block. The user pointer is
+// at the start of the mapping + sizeof(MmapHeader), or + the alignment for aligned blocks:
+// the mapping starts in the page of the header
+typedef struct {
+    size_t memory_size;  // bytes used from the start of the mapping
+    size_t mapping_size; // length of the mapping, it can be larger when reused from the cache. At least a
+                         // page, where buddy blocks have their size, always below the threshold
+} MmapHeader;
+
+static size_t page_size(void) {
+    static size_t size;
+    if (!size) size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+static size_t threshold; // 0 until the first use
+static int adaptive;
+static unsigned long large_allocs; // since the start, for the period of the adaptive threshold
+static int adapting; // an update is running
+static long last_hits, last_misses; // of the mmap cache at the last update (adapting)
+
+size_t pseudo_malloc_threshold(void) {
+    size_t bytes = __atomic_load_n(&threshold, __ATOMIC_RELAXED);
+    if (!bytes) {
+        bytes = page_size() / 4;
+        __atomic_store_n(&threshold, bytes, __ATOMIC_RELAXED);
+        Stats_threshold(bytes);
+    }
+    return bytes;
+}
+
+void pseudo_malloc_set_threshold(size_t bytes) {
+    if (bytes < page_size() / 16) bytes = page_size() / 16;
+    if (bytes > page_size()) bytes = page_size();
+    __atomic_store_n(&threshold, bytes, __ATOMIC_RELAXED);
+    Stats_threshold(bytes);
+}
+
+void pseudo_malloc_set_adaptive(int enabled) {
+    __atomic_store_n(&adaptive, enabled, __ATOMIC_RELAXED);
+}
+
+// adaptive threshold: called by the large allocations (alloc NULL for the arenas, which are never full)
+static void adapt(BuddyAllocator* alloc) {
+    // a single thread reaches the end of a period, and skips it if the update of the previous
+    // one is still running (the counts of the cache would barely have moved)
+    if (__atomic_add_fetch(&large_allocs, 1, __ATOMIC_RELAXED) % THRESHOLD_PERIOD) return;
+    if (__atomic_exchange_n(&adapting, 1, __ATOMIC_ACQUIRE)) return;
+    MmapCacheStats cache;
+    MmapCache_stats(&cache);
+    long hits = cache.hits - last_hits;
+    long misses = cache.misses - last_misses;
+    last_hits = cache.hits;
+    last_misses = cache.misses;
+    double occupancy = alloc ? (double)alloc->used_bytes / alloc->memory_size : 0;
+    size_t bytes = pseudo_malloc_threshold();
+    if (occupancy > 0.75) { // the buddy memory is left to the small requests
+        bytes /= 2;
+    } else if (misses > hits) { // most large requests paid a mmap: the buddy allocator has room for them
+        if (occupancy < 0.5) bytes *= 2;
+    } else if (hits > 3 * misses && bytes > page_size() / 4) { // the cache makes them cheap
+        bytes /= 2;
+    }
+    if (bytes != pseudo_malloc_threshold()) {
+        LOG_INFO("Threshold moved to %zu bytes (buddy occupancy %.2f, mmap cache hits %ld, misses %ld)\n", bytes, occupancy, hits, misses);
+        pseudo_malloc_set_threshold(bytes);
+    }
+    __atomic_store_n(&adapting, 0, __ATOMIC_RELEASE);
+}
+
+int pseudo_is_mapped(void* ptr) {
+    return ((size_t*)ptr)[-1] >= page_size();
+}
+
+// start of the mapping of an mmapped block
+static char* mmap_base(void* ptr) {
+    return (char*)(((uintptr_t)ptr - sizeof(MmapHeader)) & ~(uintptr_t)(page_size() - 1));
+}
+
+// maps a block of size bytes with the user pointer aligned to alignment (a power of 2).
+// fresh is set to 1 if the block comes from a new mapping, so it is already zero
+static void* mmap_malloc(size_t size, size_t alignment, int* fresh) {
+    if (size > PTRDIFF_MAX - alignment - 2 * page_size()) { // the mapping length would overflow
+        errno = ENOMEM;
         return NULL;
     }
+    size_t offset = alignment > sizeof(MmapHeader) ? alignment : sizeof(MmapHeader);
+    char* base;
+    size_t mapping_size;
+    if (alignment <= page_size()) { // the alignment of the mapping is enough
+        base = MmapCache_map(offset + size, &mapping_size, fresh); // a cached region or a new mapping
+        if (!base) return NULL;
+    } else { // map more, then unmap the pages before the aligned block and after it
+        size_t length = size + alignment + page_size();
+        char* region = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) return NULL;
+        char* ptr = (char*)(((uintptr_t)region + sizeof(MmapHeader) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+        base = mmap_base(ptr);
+        offset = ptr - base;
+        mapping_size = (offset + size + page_size() - 1) / page_size() * page_size();
+        if (base > region) munmap(region, base - region);
+        if (base + mapping_size < region + length) munmap(base + mapping_size, region + length - (base + mapping_size));
+        *fresh = 1;
+    }
+    MmapHeader* header = (MmapHeader*)(base + offset) - 1;
+    header->mapping_size = mapping_size;
+    header->memory_size = offset + size;
+    Stats_mmap(mapping_size);
+    return base + offset;
+}
+
+void* pseudo_malloc(BuddyAllocator* alloc, size_t size) {
     if (size == 0) {
-        printf("\nMalloc error: Cannot allocate 0 bytes\n");
+        LOG_ERROR("\nMalloc error: Cannot allocate 0 bytes\n");
         return NULL;
     }
 
-    if (size >= THRESHOLD) { // for large allocations use mmap
-        printf("\nAllocation to be done with mmap, size: %d\n", size);
-        int memory_size = size + sizeof(int);
-        void *p = mmap(NULL, memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (p == MAP_FAILED) {
-            printf("Malloc error: mmap failed with error: %s", strerror(errno));
+    if (!alloc || size >= pseudo_malloc_threshold()) { // for large allocations use mmap
+        if (__atomic_load_n(&adaptive, __ATOMIC_RELAXED)) adapt(alloc);
+        LOG_TRACE("\nAllocation to be done with mmap, size: %zu\n", size);
+        int fresh;
+        void *p = mmap_malloc(size, 1, &fresh);
+        if (!p) {
+            LOG_ERROR("Malloc error: mmap failed with error: %s", strerror(errno));
+            Stats_failed();
             return NULL;
         } else {
-            ((int*)p)[0] = memory_size;
-            printf("Allocation succeeded: address: %p, size: %d\n", p + sizeof(int), memory_size);
-            return (void *)(p + sizeof(int));
+            LOG_TRACE("Allocation succeeded: address: %p, size: %zu\n", p, size);
+            PROFILE_ALLOC(p, size);
+            return p;
         }
     } else { // for small allocations use buddy allocator
-        printf("\nAllocation to be done with Buddy Allocator, size: %d", size);
+        LOG_TRACE("\nAllocation to be done with Buddy Allocator, size: %zu", size);
         void* p = BuddyAllocator_malloc(alloc, size);
+        if (!p && __atomic_load_n(&adaptive, __ATOMIC_RELAXED)) { // the buddy allocator is full: it keeps smaller requests only
+            pseudo_malloc_set_threshold(pseudo_malloc_threshold() / 2);
+            int fresh;
+            p = mmap_malloc(size, 1, &fresh);
+        }
         if (!p) { // allocation error
             return NULL;
         } else {
+            PROFILE_ALLOC(p, size);
             return p;
         }
     }
 }
 
+// a block belongs to the buddy allocator if it is inside its memory, otherwise it was mmapped
+static int is_buddy_block(BuddyAllocator* alloc, void* ptr) {
+    return alloc && (char*)ptr >= alloc->memory && (char*)ptr < alloc->memory + alloc->memory_size;
+}
+
+// gives back a large block: its mapping is kept in the cache or unmapped
+static void mmap_free(void* ptr) {
+    LOG_TRACE("\nFree to be done with munmap\n");
+    MmapHeader* header = (MmapHeader*)ptr - 1;
+    Stats_mmap(-(long long)header->mapping_size);
+    MmapCache_unmap(mmap_base(ptr), header->mapping_size, header->memory_size);
+    LOG_TRACE("\nFree succeeded: Memory block at address %p freed\n", ptr);
+}
+
 void pseudo_free(BuddyAllocator* alloc, void* ptr) {
     if (!ptr) {
-        printf("\nFree error: Memory to be freed is NULL\n");
+        LOG_ERROR("\nFree error: Memory to be freed is NULL\n");
         return;
     }
+    PROFILE_FREE(ptr);
+
+    if (is_buddy_block(alloc, ptr)) {
+        LOG_TRACE("\nFree to be done with Buddy Allocator\n");
+        BuddyAllocator_free(alloc, ptr);
+    } else {
+        mmap_free(ptr);
+    }
+}
+
+void pseudo_free_sized(BuddyAllocator* alloc, void* ptr, size_t size) {
+    if (!ptr) {
+        LOG_ERROR("\nFree error: Memory to be freed is NULL\n");
+        return;
+    }
+    PROFILE_FREE(ptr);
+
+    if (!is_buddy_block(alloc, ptr)) {
+        mmap_free(ptr);
+    } else {
+        LOG_TRACE("\nFree to be done with Buddy Allocator\n");
+        BuddyAllocator_freeSized(alloc, ptr, size);
+    }
+}
+
+int pseudo_malloc_batch(BuddyAllocator* alloc, size_t size, int n, void** out) {
+    if (size == 0 || n < 0) {
+        LOG_ERROR("\nMalloc error: Invalid size (%zu) or number of blocks (%d)\n", size, n);
+        return 0;
+    }
+    if (alloc && size < pseudo_malloc_threshold()) { // the blocks are split together from the buddy allocator
+        int count = BuddyAllocator_mallocBatch(alloc, size, n, out);
+        for (int i = 0; i < count; i++) {
+            PROFILE_ALLOC(out[i], size);
+        }
+        return count;
+    }
+    for (int i = 0; i < n; i++) {
+        int fresh;
+        out[i] = mmap_malloc(size, 1, &fresh);
+        if (!out[i]) {
+            LOG_ERROR("Malloc error: mmap failed with error: %s", strerror(errno));
+            Stats_failed();
+            memset(out + i, 0, (n - i) * sizeof(void*));
+            return i;
+        }
+        PROFILE_ALLOC(out[i], size);
+    }
+    return n;
+}
+
+void pseudo_free_batch(BuddyAllocator* alloc, void** ptrs, int n) {
+    // the buddy blocks are gathered and merged together, the mmap ones are freed one by one
+    void* blocks[BUDDY_BATCH_SIZE];
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        if (!ptrs[i]) {
+            continue;
+        }
+        PROFILE_FREE(ptrs[i]);
+        if (!is_buddy_block(alloc, ptrs[i])) {
+            mmap_free(ptrs[i]);
+            continue;
+        }
+        blocks[count++] = ptrs[i];
+        if (count == BUDDY_BATCH_SIZE) {
+            BuddyAllocator_freeBatch(alloc, blocks, count);
+            count = 0;
+        }
+    }
+    if (count) {
+        BuddyAllocator_freeBatch(alloc, blocks, count);
+    }
+}
 
-    int* original_ptr = (int*)((char*)ptr - sizeof(int));
-    int size = *original_ptr;
+void* pseudo_realloc(BuddyAllocator* alloc, void* ptr, size_t size) {
+    if (!ptr) {
+        return pseudo_malloc(alloc, size);
+    }
+    if (size > PTRDIFF_MAX - 2 * page_size()) {
+        LOG_ERROR("\nRealloc error: Invalid Size (%zu)\n", size);
+        return NULL;
+    }
+    if (size == 0) {
+        pseudo_free(alloc, ptr);
+        return NULL;
+    }
 
-    if (size >= THRESHOLD) {
-        printf("\nFree to be done with munmap\n");
-        int ret = munmap((void*)original_ptr, size);
-        if (ret != 0) {
-            printf("\nFree error: munmap failed\n");
-            return;
+    size_t old_size;
+    if (is_buddy_block(alloc, ptr)) {
+        // the block is resized in place when the new size stays in the buddy allocator
+        if (size < pseudo_malloc_threshold() && BuddyAllocator_resize(alloc, ptr, size)) {
+            PROFILE_FREE(ptr); // sampled again with its new size
+            PROFILE_ALLOC(ptr, size);
+            return ptr;
         }
-        printf("\nFree succeeded: Memory block at address %p freed\n", ptr);
+        old_size = BuddyAllocator_usableSize(alloc, ptr);
     } else {
-        printf("\nFree to be done with Buddy Allocator\n");
-        BuddyAllocator_free(alloc, ptr);
+        MmapHeader* header = (MmapHeader*)ptr - 1;
+        char* base = mmap_base(ptr);
+        size_t offset = (char*)ptr - base;
+        if (!alloc || size >= pseudo_malloc_threshold()) {
+            void* old_ptr = ptr;
+            size_t memory_size = offset + size;
+            if (memory_size > header->mapping_size) { // the kernel moves the pages, nothing is copied
+                size_t mapping_size = (memory_size + page_size() - 1) / page_size() * page_size();
+                void* p = mremap(base, header->mapping_size, mapping_size, MREMAP_MAYMOVE);
+                if (p == MAP_FAILED) { // the block is left as it was, with its sample
+                    LOG_ERROR("Realloc error: mremap failed with error: %s", strerror(errno));
+                    Stats_failed();
+                    return NULL;
+                }
+                ptr = (char*)p + offset; // a page multiple: the alignment is kept
+                header = (MmapHeader*)ptr - 1;
+                Stats_mmap((long long)mapping_size - (long long)header->mapping_size);
+                header->mapping_size = mapping_size;
+            }
+            header->memory_size = memory_size;
+            PROFILE_FREE(old_ptr); // sampled again with its new size and address
+            PROFILE_ALLOC(ptr, size);
+            return ptr;
+        }
+        old_size = header->memory_size - offset;
+    }
+
+    // the block moves between the buddy allocator and mmap, or has no room to grow
+    void* p = pseudo_malloc(alloc, size);
+    if (!p) {
+        return NULL;
+    }
+    memcpy(p, ptr, old_size < size ? old_size : size);
+    pseudo_free(alloc, ptr);
+    return p;
+}
+
+void* pseudo_calloc(BuddyAllocator* alloc, size_t nmemb, size_t size) {
+    if (size > 0 && nmemb > SIZE_MAX / size) {
+        LOG_ERROR("\nCalloc error: Invalid Size\n");
+        return NULL;
     }
+    size_t total = nmemb * size;
+    if (!alloc || total >= pseudo_malloc_threshold()) {
+        int fresh;
+        void* p = mmap_malloc(total, 1, &fresh);
+        if (!p) {
+            LOG_ERROR("Malloc error: mmap failed with error: %s", strerror(errno));
+            Stats_failed();
+            return NULL;
+        }
+        if (!fresh) memset(p, 0, total); // the pages of a new mapping are already zero
+        PROFILE_ALLOC(p, total);
+        return p;
+    }
+    void* p = pseudo_malloc(alloc, total);
+    if (p) memset(p, 0, total);
+    return p;
+}
+
+void* pseudo_aligned_alloc(BuddyAllocator* alloc, size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) || size == 0 || alignment > PTRDIFF_MAX / 2) {
+        LOG_ERROR("\nMalloc error: Invalid alignment (%zu) or size (%zu)\n", alignment, size);
+        return NULL;
+    }
+    // the buddy block must have room for the padding too
+    void* p;
+    if (alloc && size < pseudo_malloc_threshold() && alignment < pseudo_malloc_threshold() - size) {
+        p = BuddyAllocator_mallocAligned(alloc, size, alignment);
+    } else {
+        int fresh;
+        p = mmap_malloc(size, alignment, &fresh);
+        if (!p) {
+            LOG_ERROR("Malloc error: mmap failed with error: %s", strerror(errno));
+        }
+    }
+    if (!p) Stats_failed();
+    else PROFILE_ALLOC(p, size);
+    return p;
+}
+
+int pseudo_posix_memalign(BuddyAllocator* alloc, void** memptr, size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) || alignment % sizeof(void*)) {
+        return EINVAL;
+    }
+    if (size == 0) {
+        *memptr = NULL;
+        return 0;
+    }
+    void* p = pseudo_aligned_alloc(alloc, alignment, size);
+    if (!p) {
+        return ENOMEM;
+    }
+    *memptr = p;
+    return 0;
+}
+
+size_t pseudo_usable_size(BuddyAllocator* alloc, void* ptr) {
+    if (!ptr) {
+        return 0;
+    }
+    if (is_buddy_block(alloc, ptr)) {
+        return BuddyAllocator_usableSize(alloc, ptr);
+    }
+    // the whole mapping after the user pointer can be used
+    MmapHeader* header = (MmapHeader*)ptr - 1;
+    return header->mapping_size - ((char*)ptr - mmap_base(ptr));
+}
+
+size_t pseudo_malloc_trim(BuddyAllocator* alloc) {
+    size_t purged = alloc ? BuddyAllocator_purge(alloc) : 0;
+    MmapCache_flush();
+    return purged;
 }
@@ -1,7 +1,56 @@
 #pragma once
 #include "buddy_allocator.h"
+#include "mmap_cache.h"
+#include "stats.h"
 
-#define THRESHOLD 1024 // 1/4 of page size (4096 / 4)
+#define THRESHOLD_PERIOD 64 // large allocations between two updates of the adaptive threshold
 
-void* pseudo_malloc(BuddyAllocator* alloc, int size);
+// requests of at least the threshold bytes are mmapped, the others go to the buddy allocator.
+// It is 1/4 of the page size by default, and always between 1/16 of the page and the page,
+// so that the size_t before a user pointer tells the path of the block (pseudo_is_mapped)
+size_t pseudo_malloc_threshold(void);
+void pseudo_malloc_set_threshold(size_t bytes);
+
+// adaptive threshold: every THRESHOLD_PERIOD large allocations it is halved when the buddy
+// allocator is more than 3/4 full, doubled when most large requests missed the mmap cache
+// (a syscall each) and the buddy allocator is less than half full, and brought back towards
+// the default when the cache serves them. A small request that finds the buddy allocator
+// full halves it and is mmapped
+void pseudo_malloc_set_adaptive(int enabled);
+
+// the block was allocated by the mmap path
+int pseudo_is_mapped(void* ptr);
+
+// allocates size bytes: alloc NULL always uses the mmap path. Sizes are 64 bits: requests
+// larger than PTRDIFF_MAX fail
+void* pseudo_malloc(BuddyAllocator* alloc, size_t size);
 void pseudo_free(BuddyAllocator* alloc, void* ptr);
+
+// frees a block knowing the size it was allocated with, skipping the lookup of its level
+void pseudo_free_sized(BuddyAllocator* alloc, void* ptr, size_t size);
+
+// allocates n blocks of size bytes in out, returns how many were allocated (the rest of out is NULL)
+int pseudo_malloc_batch(BuddyAllocator* alloc, size_t size, int n, void** out);
+
+// frees the n blocks of ptrs (NULL entries are skipped)
+void pseudo_free_batch(BuddyAllocator* alloc, void** ptrs, int n);
+
+// changes the size of a block keeping its content: buddy blocks are resized in place
+// when possible, mmap blocks are grown with mremap, blocks crossing the threshold are moved
+void* pseudo_realloc(BuddyAllocator* alloc, void* ptr, size_t size);
+
+// allocates nmemb * size bytes set to zero (new mmapped pages are zero already), NULL if the product overflows
+void* pseudo_calloc(BuddyAllocator* alloc, size_t nmemb, size_t size);
+
+// allocates size bytes aligned to alignment, a power of 2
+void* pseudo_aligned_alloc(BuddyAllocator* alloc, size_t alignment, size_t size);
+
+// as pseudo_aligned_alloc, returning 0, EINVAL or ENOMEM like posix_memalign
+int pseudo_posix_memalign(BuddyAllocator* alloc, void** memptr, size_t alignment, size_t size);
+
+// bytes that the user can use in a block
+size_t pseudo_usable_size(BuddyAllocator* alloc, void* ptr);
+
+// gives the free memory back to the OS: the free pages of the buddy allocator (alloc may be
+// NULL) and the regions of the mmap cache. Returns the bytes purged from the buddy allocator
+size_t pseudo_malloc_trim(BuddyAllocator* alloc);
@@ -1,12 +1,16 @@
 #include "pseudo_malloc.h"
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
 
 #define BUFFER_SIZE 131072
 #define BUDDY_LEVELS 19
 #define MEMORY_SIZE (1024*1024)
 #define MIN_BUCKET_SIZE (MEMORY_SIZE >> BUDDY_LEVELS)
-#define THRESHOLD 1024  // 1/4 della dimensione della pagina (4096 / 4)
+#define PAGE_BYTES ((size_t)sysconf(_SC_PAGESIZE))
+#define THRESHOLD (PAGE_BYTES / 4)  // 1/4 della dimensione della pagina
 
 char buffer[BUFFER_SIZE]; // 128 KB buffer to handle memory
 char memory[MEMORY_SIZE];
@@ -20,6 +24,10 @@ typedef struct {
 
 TestResult test_result = {0, 0};
 
+bool is_buddy_pointer(void* p) {
+    return (char*)p >= memory && (char*)p < memory + MEMORY_SIZE;
+}
+
 void print_test_result(bool passed, const char* description) {
     test_result.total_tests++;
     if (passed) {
@@ -92,9 +100,9 @@ void test_edge_cases() {
     void* p1 = pseudo_malloc(&buddy_allocator, 0);
     print_test_result(p1 == NULL, "Correctly failed to allocate 0 bytes");
 
-    // Allocazione di dimensioni negative (deve fallire)
+    // Allocazione di dimensioni negative (deve fallire): oltre PTRDIFF_MAX
     void* p2 = pseudo_malloc(&buddy_allocator, -100);
-    print_test_result(p2 == NULL, "Correctly failed to allocate -100 bytes");
+    print_test_result(p2 == NULL, "Correctly failed to allocate (size_t)-100 bytes");
 
     printf("== Edge case tests completed ==\n");
 }
@@ -124,6 +132,279 @@ void test_combined_allocations() {
     printf("== Combined allocation tests completed ==\n");
 }
 
+void test_sized_free() {
+    printf("\n== Running sized free tests ==\n");
+
+    void* p1 = pseudo_malloc(&buddy_allocator, 100);    // Buddy Allocator
+    void* p2 = pseudo_malloc(&buddy_allocator, 5000);   // mmap
+    print_test_result(p1 != NULL && p2 != NULL, "Allocate 100 bytes with Buddy Allocator and 5000 bytes with mmap");
+    pseudo_free_sized(&buddy_allocator, p1, 100);
+    pseudo_free_sized(&buddy_allocator, p2, 5000);
+
+    // everything has been given back
+    void* p3 = BuddyAllocator_malloc(&buddy_allocator, MEMORY_SIZE - 16);
+    print_test_result(p3 != NULL, "Whole buddy memory free after the sized frees");
+    pseudo_free(&buddy_allocator, p3);
+
+    printf("== Sized free tests completed ==\n");
+}
+
+void test_mmap_cache() {
+    printf("\n== Running mmap cache tests ==\n");
+
+    MmapCache_flush();
+    MmapCacheStats before, after;
+    MmapCache_stats(&before);
+
+    // a freed region is reused by the next request of the same size
+    void* p1 = pseudo_malloc(&buddy_allocator, 5000);
+    pseudo_free(&buddy_allocator, p1);
+    void* p2 = pseudo_malloc(&buddy_allocator, 5000);
+    MmapCache_stats(&after);
+    print_test_result(p2 == p1 && after.hits == before.hits + 1, "Region of a freed 5000 bytes block reused without mmap");
+
+    // a larger region is reused for a smaller request
+    void* p3 = pseudo_malloc(&buddy_allocator, 60000);
+    pseudo_free(&buddy_allocator, p3);
+    void* p4 = pseudo_malloc(&buddy_allocator, 40000);
+    print_test_result(p4 == p3, "Region of 60000 bytes reused for 40000 bytes");
+    memset(p4, 1, 40000);
+
+    pseudo_free(&buddy_allocator, p2);
+    pseudo_free(&buddy_allocator, p4);
+    MmapCache_stats(&after);
+    print_test_result(after.cached_regions == 2 && after.resident_bytes <= after.cached_bytes, "Freed regions kept in the cache");
+
+    // with no room in the cache the regions are unmapped
+    MmapCache_config(0, MMAP_CACHE_MAX_AGE_MS);
+    MmapCache_stats(&after);
+    print_test_result(after.cached_regions == 0 && after.cached_bytes == 0, "Cache emptied when its limit is set to 0");
+    void* p5 = pseudo_malloc(&buddy_allocator, 5000);
+    pseudo_free(&buddy_allocator, p5);
+    MmapCache_stats(&after);
+    print_test_result(after.cached_regions == 0, "Freed region unmapped when the cache is disabled");
+    MmapCache_config(MMAP_CACHE_MAX_BYTES, MMAP_CACHE_MAX_AGE_MS);
+
+    printf("== Mmap cache tests completed ==\n");
+}
+
+// checks that the first n bytes of a block still have the value written at the start
+bool check_content(void* p, int n, unsigned char value) {
+    for (int i = 0; i < n; i++) {
+        if (((unsigned char*)p)[i] != value) return false;
+    }
+    return true;
+}
+
+void test_realloc() {
+    printf("\n== Running realloc tests ==\n");
+
+    void* p = pseudo_realloc(&buddy_allocator, NULL, 100);
+    print_test_result(p != NULL, "Realloc of NULL allocates 100 bytes");
+    memset(p, 0x5A, 100);
+
+    void* q = pseudo_realloc(&buddy_allocator, p, 200);
+    print_test_result(q == p && check_content(q, 100, 0x5A), "Grow 100 to 200 bytes in place (free buddy)");
+
+    q = pseudo_realloc(&buddy_allocator, q, 50);
+    print_test_result(q == p && check_content(q, 50, 0x5A), "Shrink 200 to 50 bytes in place");
+
+    p = pseudo_realloc(&buddy_allocator, q, 3000);
+    print_test_result(p != NULL && !is_buddy_pointer(p) && check_content(p, 50, 0x5A), "Grow 50 to 3000 bytes: moved to mmap");
+    memset(p, 0x3C, 3000);
+
+    q = pseudo_realloc(&buddy_allocator, p, 200000);
+    print_test_result(q != NULL && check_content(q, 3000, 0x3C), "Grow 3000 to 200000 bytes with mremap");
+    memset(q, 0x11, 200000);
+
+    p = pseudo_realloc(&buddy_allocator, q, 500);
+    print_test_result(p != NULL && is_buddy_pointer(p) && check_content(p, 500, 0x11), "Shrink 200000 to 500 bytes: moved to the Buddy Allocator");
+
+    p = pseudo_realloc(&buddy_allocator, p, 0);
+    print_test_result(p == NULL, "Realloc to 0 bytes frees the block");
+
+    void* whole = BuddyAllocator_malloc(&buddy_allocator, MEMORY_SIZE - 16);
+    print_test_result(whole != NULL, "Whole buddy memory free after the reallocs");
+    pseudo_free(&buddy_allocator, whole);
+
+    printf("== Realloc tests completed ==\n");
+}
+
+void test_calloc_and_aligned() {
+    printf("\n== Running calloc and aligned allocation tests ==\n");
+
+    // dirty a buddy block and an mmap region, calloc must give them back zeroed
+    void* dirty = pseudo_malloc(&buddy_allocator, 300);
+    memset(dirty, 0xFF, 300);
+    pseudo_free(&buddy_allocator, dirty);
+    dirty = pseudo_malloc(&buddy_allocator, 8000);
+    memset(dirty, 0xFF, 8000);
+    pseudo_free(&buddy_allocator, dirty);
+
+    void* p1 = pseudo_calloc(&buddy_allocator, 30, 10);
+    print_test_result(p1 != NULL && check_content(p1, 300, 0), "Calloc 30 x 10 bytes with Buddy Allocator is zeroed");
+    void* p2 = pseudo_calloc(&buddy_allocator, 1000, 8);
+    print_test_result(p2 != NULL && check_content(p2, 8000, 0), "Calloc 1000 x 8 bytes with mmap (reused region) is zeroed");
+    void* p3 = pseudo_calloc(&buddy_allocator, 1 << 20, 4);
+    print_test_result(p3 != NULL && check_content(p3, 4 << 20, 0), "Calloc 4 MB with a new mapping is zeroed");
+    void* p4 = pseudo_calloc(&buddy_allocator, SIZE_MAX / 2, 4);
+    print_test_result(p4 == NULL, "Correctly failed to calloc an overflowing size");
+    pseudo_free(&buddy_allocator, p1);
+    pseudo_free(&buddy_allocator, p2);
+    pseudo_free(&buddy_allocator, p3);
+
+    int alignments[] = {16, 64, 256, 4096, 65536};
+    int sizes[] = {24, 100, 500, 100, 5000};
+    for (int i = 0; i < 5; i++) {
+        void* p = pseudo_aligned_alloc(&buddy_allocator, alignments[i], sizes[i]);
+        char description[128];
+        sprintf(description, "Allocate %d bytes aligned to %d", sizes[i], alignments[i]);
+        print_test_result(p != NULL && (size_t)p % alignments[i] == 0, description);
+        if (p) {
+            memset(p, 0x42, sizes[i]);
+            pseudo_free(&buddy_allocator, p);
+        }
+    }
+
+    void* p5;
+    print_test_result(pseudo_posix_memalign(&buddy_allocator, &p5, 32, 200) == 0 && (size_t)p5 % 32 == 0, "posix_memalign 200 bytes aligned to 32");
+    pseudo_free(&buddy_allocator, p5);
+    print_test_result(pseudo_posix_memalign(&buddy_allocator, &p5, 24, 200) == EINVAL, "posix_memalign rejects an alignment of 24");
+
+    void* whole = BuddyAllocator_malloc(&buddy_allocator, MEMORY_SIZE - 16);
+    print_test_result(whole != NULL, "Whole buddy memory free after the aligned allocations");
+    pseudo_free(&buddy_allocator, whole);
+
+    printf("== Calloc and aligned allocation tests completed ==\n");
+}
+
+void test_stats() {
+    printf("\n== Running statistics tests ==\n");
+
+    PseudoMallocStats before, during, after;
+    pseudo_malloc_stats(&before);
+    void* small = pseudo_malloc(&buddy_allocator, 100); // 108 bytes with the header: a 128 bytes block
+    void* large = pseudo_malloc(&buddy_allocator, 10000);
+    int level = BuddyAllocator_level(&buddy_allocator, 108);
+    pseudo_malloc_stats(&during);
+    print_test_result(during.level_allocs[level] == before.level_allocs[level] + 1, "Allocation counted on the level of its block");
+    print_test_result(during.buddy_bytes == before.buddy_bytes + 128, "Buddy bytes in use grow by the block size");
+    print_test_result(during.requested_bytes == before.requested_bytes + 100 && during.block_bytes == before.block_bytes + 128,
+                      "Requested and block bytes recorded for the fragmentation");
+    print_test_result(during.mmap_bytes >= before.mmap_bytes + 10000, "Mmap bytes in use grow by the mapping");
+    print_test_result(during.peak_bytes >= during.buddy_bytes + during.mmap_bytes, "Peak covers the current usage");
+    print_test_result(during.fragmentation > 0 && during.fragmentation < 1, "Fragmentation estimate between 0 and 1");
+
+    pseudo_free(&buddy_allocator, small);
+    pseudo_free(&buddy_allocator, large);
+    print_test_result(BuddyAllocator_malloc(&buddy_allocator, MEMORY_SIZE) == NULL, "Correctly failed to allocate the whole memory plus the header");
+    pseudo_malloc_stats(&after);
+    print_test_result(after.level_frees[level] == during.level_frees[level] + 1, "Free counted on the level of its block");
+    print_test_result(after.buddy_bytes == before.buddy_bytes && after.mmap_bytes == before.mmap_bytes, "Bytes in use back to the start after the frees");
+    print_test_result(after.failed_allocs == before.failed_allocs + 1, "Failed allocation counted");
+    print_test_result(after.peak_bytes == during.peak_bytes, "Peak kept after the frees");
+
+    printf("== Statistics tests completed ==\n");
+}
+
+void test_batch() {
+    printf("\n== Running batch allocation tests ==\n");
+
+    void* small[300];
+    void* large[4];
+    int n = pseudo_malloc_batch(&buddy_allocator, 100, 300, small);
+    bool all_buddy = n == 300;
+    for (int i = 0; i < n; i++) all_buddy = all_buddy && is_buddy_pointer(small[i]);
+    print_test_result(all_buddy, "Batch of 300 blocks of 100 bytes with Buddy Allocator");
+    n = pseudo_malloc_batch(&buddy_allocator, 5000, 4, large);
+    bool all_mmap = n == 4;
+    for (int i = 0; i < n; i++) all_mmap = all_mmap && !is_buddy_pointer(large[i]);
+    print_test_result(all_mmap, "Batch of 4 blocks of 5000 bytes with mmap");
+
+    // a mixed batch, with NULL entries: the buddy blocks are merged together
+    void* mixed[306];
+    memcpy(mixed, small, sizeof(small));
+    memcpy(mixed + 300, large, sizeof(large));
+    mixed[304] = mixed[305] = NULL;
+    pseudo_free_batch(&buddy_allocator, mixed, 306);
+    void* whole = BuddyAllocator_malloc(&buddy_allocator, MEMORY_SIZE - 16);
+    print_test_result(whole != NULL, "Whole buddy memory free after the batch free");
+    pseudo_free(&buddy_allocator, whole);
+
+    printf("== Batch allocation tests completed ==\n");
+}
+
+void test_threshold() {
+    printf("\n== Running threshold tests ==\n");
+
+    PseudoMallocStats stats;
+    size_t large = PAGE_BYTES + 904; // above the threshold whatever it is
+    print_test_result(pseudo_malloc_threshold() == THRESHOLD, "Default threshold of 1/4 of the page");
+    pseudo_malloc_set_threshold(PAGE_BYTES / 2);
+    void* p = pseudo_malloc(&buddy_allocator, PAGE_BYTES / 2 - 100);
+    print_test_result(is_buddy_pointer(p), "Allocate below a threshold of half a page with Buddy Allocator");
+    pseudo_free(&buddy_allocator, p);
+    pseudo_malloc_stats(&stats);
+    print_test_result(stats.threshold == PAGE_BYTES / 2, "Threshold reported by the statistics");
+    pseudo_malloc_set_threshold(1);
+    print_test_result(pseudo_malloc_threshold() == PAGE_BYTES / 16, "Threshold raised to 1/16 of the page");
+    pseudo_malloc_set_threshold(PAGE_BYTES << 4);
+    print_test_result(pseudo_malloc_threshold() == PAGE_BYTES, "Threshold lowered to the page size");
+
+    // every 64 large allocations the threshold follows the buddy occupancy and the mmap cache
+    pseudo_malloc_set_adaptive(1);
+    pseudo_malloc_set_threshold(THRESHOLD);
+    void* whole = BuddyAllocator_malloc(&buddy_allocator, MEMORY_SIZE - 16);
+    for (int i = 0; i < 64; i++) pseudo_free(&buddy_allocator, pseudo_malloc(&buddy_allocator, large));
+    print_test_result(pseudo_malloc_threshold() == THRESHOLD / 2, "Threshold halved while the buddy memory is full");
+    p = pseudo_malloc(&buddy_allocator, 100);
+    print_test_result(p && !is_buddy_pointer(p) && pseudo_malloc_threshold() == THRESHOLD / 4,
+                      "Buddy failure served by mmap, threshold halved");
+    pseudo_free(&buddy_allocator, p);
+    pseudo_free(&buddy_allocator, whole);
+
+    pseudo_malloc_set_threshold(PAGE_BYTES);
+    for (int i = 0; i < 64; i++) pseudo_free(&buddy_allocator, pseudo_malloc(&buddy_allocator, large));
+    print_test_result(pseudo_malloc_threshold() == PAGE_BYTES / 2, "Threshold halved when the mmap cache serves the large requests");
+
+    pseudo_malloc_set_threshold(PAGE_BYTES / 8);
+    void* blocks[128];
+    for (int i = 0; i < 128; i++) blocks[i] = pseudo_malloc(&buddy_allocator, 2 * PAGE_BYTES + i * PAGE_BYTES); // all misses
+    print_test_result(pseudo_malloc_threshold() > PAGE_BYTES / 8, "Threshold raised when the large requests miss the cache");
+    for (int i = 0; i < 128; i++) pseudo_free(&buddy_allocator, blocks[i]);
+
+    pseudo_malloc_set_adaptive(0);
+    pseudo_malloc_set_threshold(THRESHOLD);
+
+    printf("== Threshold tests completed ==\n");
+}
+
+void test_large_mapping() {
+    printf("\n== Running multi-gigabyte allocation tests ==\n");
+
+    // sizes past 2 GB go through the mmap path with 64-bit lengths
+    size_t size = 3UL << 30;
+    char* p = pseudo_malloc(&buddy_allocator, size);
+    if (!p) {
+        printf("[INFO] Cannot map 3 GB, skipped\n");
+        return;
+    }
+    p[0] = 1;
+    p[size - 1] = 2; // only the first and last pages become resident
+    print_test_result(pseudo_is_mapped(p) && pseudo_usable_size(&buddy_allocator, p) >= size, "Allocate 3 GB with mmap");
+    size_t larger = size + (512UL << 20);
+    char* q = pseudo_realloc(&buddy_allocator, p, larger);
+    print_test_result(q && q[0] == 1 && q[size - 1] == 2 && pseudo_usable_size(&buddy_allocator, q) >= larger, "Grow 3 GB to 3.5 GB with mremap");
+    if (q) {
+        q[larger - 1] = 3;
+        pseudo_free(&buddy_allocator, q);
+    } else {
+        pseudo_free(&buddy_allocator, p);
+    }
+
+    printf("== Multi-gigabyte allocation tests completed ==\n");
+}
+
 void print_final_results() {
     printf("\n========== TEST RESULTS ==========\n");
     printf("Total tests run: %d\n", test_result.total_tests);
@@ -146,6 +427,14 @@ int main(int argc, char** argv) {
     test_large_allocations();
     test_edge_cases();
     test_combined_allocations();
+    test_sized_free();
+    test_mmap_cache();
+    test_realloc();
+    test_calloc_and_aligned();
+    test_stats();
+    test_batch();
+    test_threshold();
+    test_large_mapping();
 
     // Print final results
     print_final_results();
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "region.h"
+#include "log.h"
+
+// the objects of a chunk start after its header, aligned
+#define CHUNK_HEADER ((sizeof(RegionChunk) + REGION_ALIGNMENT - 1) & ~(size_t)(REGION_ALIGNMENT - 1))
+
+int Region_init(Region* region, BuddyAllocator* buddy, size_t chunk_size){
+    if (chunk_size < sizeof(BuddyHeader) + CHUNK_HEADER + REGION_ALIGNMENT || chunk_size > buddy->memory_size){
+        LOG_ERROR("Region error: invalid chunk size %zu\n", chunk_size);
+        return -1;
+    }
+    region->buddy = buddy;
+    region->chunk = NULL;
+    region->top = region->end = NULL;
+    region->chunk_size = chunk_size;
+    return 0;
+}
+
+// takes a chunk that holds at least bytes bytes of objects: the rest of the current
+// chunk is lost, objects larger than a chunk get one of their size
+static int Region_grow(Region* region, size_t bytes){
+    size_t size = region->chunk_size - sizeof(BuddyHeader);
+    if (bytes > SIZE_MAX - CHUNK_HEADER) bytes = SIZE_MAX - CHUNK_HEADER; // fails in the buddy allocator
+    if (size < CHUNK_HEADER + bytes) size = CHUNK_HEADER + bytes;
+    RegionChunk* chunk = BuddyAllocator_malloc(region->buddy, size);
+    if (!chunk) return -1;
+    chunk->prev = region->chunk;
+    chunk->size = size;
+    region->chunk = chunk;
+    region->top = (char*)chunk + CHUNK_HEADER;
+    region->end = (char*)chunk + BuddyAllocator_usableSize(region->buddy, chunk);
+    return 0;
+}
+
+void* Region_malloc(Region* region, size_t size){
+    if (size == 0 || size > SIZE_MAX - REGION_ALIGNMENT){
+        LOG_ERROR("\nRegion error: Cannot allocate %zu bytes\n", size);
+        return NULL;
+    }
+    size_t bytes = (size + REGION_ALIGNMENT - 1) & ~(size_t)(REGION_ALIGNMENT - 1);
+    if ((size_t)(region->end - region->top) < bytes && Region_grow(region, bytes) != 0){
+        return NULL;
+    }
+    void* ptr = region->top;
+    region->top += bytes;
+    return ptr;
+}
+
+RegionMark Region_mark(Region* region){
+    return (RegionMark){region->chunk, region->top};
+}
+
+void Region_rewind(Region* region, RegionMark mark){
+    // the chunk of the mark must still be in the region, and the mark before the top
+    RegionChunk* chunk = region->chunk;
+    while (chunk != mark.chunk && chunk) chunk = chunk->prev;
+    if (chunk != mark.chunk || (mark.chunk == region->chunk && mark.top > region->top)){
+        LOG_ERROR("Region error: mark %p no longer in the region\n", (void*)mark.top);
+        return;
+    }
+    // one free per chunk, the objects have no headers
+    while (region->chunk != mark.chunk){
+        chunk = region->chunk;
+        region->chunk = chunk->prev;
+        BuddyAllocator_freeSized(region->buddy, chunk, chunk->size);
+        region->end = NULL;
+    }
+    if (!region->end && region->chunk){
+        region->end = (char*)region->chunk + BuddyAllocator_usableSize(region->buddy, region->chunk);
+    }
+    region->top = mark.top;
+}
+
+void Region_reset(Region* region){
+    RegionChunk* first = region->chunk;
+    if (!first) return;
+    while (first->prev) first = first->prev;
+    Region_rewind(region, (RegionMark){first, (char*)first + CHUNK_HEADER});
+}
+
+void Region_destroy(Region* region){
+    Region_rewind(region, (RegionMark){NULL, NULL});
+}
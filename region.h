@@ -0,0 +1,48 @@
+#pragma once
+#include <stddef.h>
+#include "buddy_allocator.h"
+
+#define REGION_ALIGNMENT 16 // objects keep the alignment of malloc
+
+// block of the buddy allocator in which the objects of a region are carved,
+// after the block header and this one
+typedef struct RegionChunk {
+    struct RegionChunk* prev; // chunk filled before this one
+    size_t size;              // bytes requested to the buddy allocator
+} RegionChunk;
+
+// Objects that all die together (the objects of a request, of a parse, of a frame):
+// they are bump allocated in chunks taken from the buddy allocator and freed together,
+// with one free per chunk, without headers or free lists of their own.
+typedef struct {
+    BuddyAllocator* buddy;
+    RegionChunk* chunk; // chunk being filled, NULL if the region has none
+    char* top;          // first free byte of the chunk
+    char* end;
+    size_t chunk_size;  // bytes of a chunk, larger for the objects that do not fit
+} Region;
+
+// position of a region, to free the objects allocated after it
+typedef struct {
+    RegionChunk* chunk;
+    char* top;
+} RegionMark;
+
+// initializes an empty region taking chunks of chunk_size bytes (blocks included) from buddy.
+// Returns 0 on success, -1 if chunk_size is too small or larger than the buddy memory
+int Region_init(Region* region, BuddyAllocator* buddy, size_t chunk_size);
+
+// allocates size bytes, aligned to REGION_ALIGNMENT. Returns NULL if the buddy allocator
+// has no block for a new chunk
+void* Region_malloc(Region* region, size_t size);
+
+// marks can be nested: Region_rewind frees everything allocated after a mark, and the marks
+// taken after it can no longer be used
+RegionMark Region_mark(Region* region);
+void Region_rewind(Region* region, RegionMark mark);
+
+// frees all the objects but keeps the first chunk for the next ones
+void Region_reset(Region* region);
+
+// frees all the objects and the chunks
+void Region_destroy(Region* region);
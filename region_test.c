@@ -0,0 +1,167 @@
+#include "region.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define BUFFER_SIZE 131072
+#define BUDDY_LEVELS 16
+#define MEMORY_SIZE (1024*1024)
+#define MIN_BUCKET_SIZE (MEMORY_SIZE >> BUDDY_LEVELS)
+#define CHUNK_SIZE 4096
+#define NUM_OBJECTS 10000 // 24 byte objects, 320 KB with the alignment: about 80 chunks
+
+char buffer[BUFFER_SIZE];
+char memory[MEMORY_SIZE];
+
+BuddyAllocator buddy_allocator;
+
+typedef struct {
+    int total_tests;
+    int passed_tests;
+} TestResult;
+
+TestResult test_result = {0, 0};
+
+void print_test_result(bool passed, const char* description) {
+    test_result.total_tests++;
+    if (passed) {
+        test_result.passed_tests++;
+        printf("[SUCCESS] %s\n", description);
+    } else {
+        printf("[ERROR] %s\n", description);
+    }
+}
+
+static int count_chunks(Region* region) {
+    int count = 0;
+    for (RegionChunk* chunk = region->chunk; chunk; chunk = chunk->prev) count++;
+    return count;
+}
+
+void test_bump_allocation() {
+    printf("\n== Running bump allocation tests ==\n");
+
+    Region region;
+    print_test_result(Region_init(&region, &buddy_allocator, 16) == -1, "Chunk too small refused");
+    print_test_result(Region_init(&region, &buddy_allocator, 2 * MEMORY_SIZE) == -1, "Chunk larger than the memory refused");
+    Region_init(&region, &buddy_allocator, CHUNK_SIZE);
+
+    char* a = Region_malloc(&region, 24);
+    char* b = Region_malloc(&region, 1);
+    char* c = Region_malloc(&region, 100);
+    print_test_result(a && b == a + 32 && c == b + 16, "Objects follow each other, rounded to 16 bytes");
+    print_test_result(((uintptr_t)a | (uintptr_t)b | (uintptr_t)c) % REGION_ALIGNMENT == 0, "Objects aligned to 16 bytes");
+    print_test_result(count_chunks(&region) == 1 && buddy_allocator.used_bytes == CHUNK_SIZE,
+                      "One buddy block for all of them");
+    print_test_result(Region_malloc(&region, 0) == NULL, "Allocation of 0 bytes refused");
+
+    static char* objects[NUM_OBJECTS];
+    bool all_allocated = true, intact = true;
+    for (int i = 0; i < NUM_OBJECTS; i++) {
+        objects[i] = Region_malloc(&region, 24);
+        if (!objects[i]) { all_allocated = false; break; }
+        memset(objects[i], i & 0xFF, 24);
+    }
+    for (int i = 0; i < NUM_OBJECTS && all_allocated; i++) {
+        for (int j = 0; j < 24; j++) {
+            if ((unsigned char)objects[i][j] != (i & 0xFF)) intact = false;
+        }
+    }
+    print_test_result(all_allocated && intact, "10000 objects allocated in a chain of chunks without overlaps");
+    int chunks = count_chunks(&region);
+    print_test_result(chunks > 1 && chunks <= NUM_OBJECTS * 32 / (CHUNK_SIZE - 64) + 2, "Chunks filled before a new one is taken");
+
+    // an object larger than a chunk gets a chunk of its own
+    char* large = Region_malloc(&region, 3 * CHUNK_SIZE);
+    print_test_result(large && BuddyAllocator_usableSize(&buddy_allocator, region.chunk) >= 3 * CHUNK_SIZE + 16,
+                      "Object larger than a chunk in a chunk of its size");
+    memset(large, 1, 3 * CHUNK_SIZE);
+    print_test_result(Region_malloc(&region, MEMORY_SIZE) == NULL, "Object larger than the memory refused");
+
+    Region_destroy(&region);
+    print_test_result(region.chunk == NULL && buddy_allocator.used_bytes == 0, "Region destroyed: all the chunks freed");
+    void* whole = BuddyAllocator_malloc(&buddy_allocator, MEMORY_SIZE - sizeof(BuddyHeader));
+    print_test_result(whole != NULL, "Chunks merged back into the whole memory");
+    BuddyAllocator_free(&buddy_allocator, whole);
+
+    printf("== Bump allocation tests completed ==\n");
+}
+
+void test_mark_rewind() {
+    printf("\n== Running mark and rewind tests ==\n");
+
+    Region region;
+    Region_init(&region, &buddy_allocator, CHUNK_SIZE);
+    Region_malloc(&region, 100);
+    size_t used = buddy_allocator.used_bytes;
+
+    // nested scopes: the inner one ends first
+    RegionMark outer = Region_mark(&region);
+    char* first = Region_malloc(&region, 64);
+    RegionMark inner = Region_mark(&region);
+    char* second = Region_malloc(&region, 64);
+    for (int i = 0; i < 1000; i++) Region_malloc(&region, 200);
+    print_test_result(count_chunks(&region) > 1, "Inner scope spans several chunks");
+    Region_rewind(&region, inner);
+    print_test_result(count_chunks(&region) == 1 && Region_malloc(&region, 64) == second,
+                      "Inner scope rewound: its chunks freed, its space reused");
+    Region_rewind(&region, outer);
+    print_test_result(Region_malloc(&region, 64) == first && buddy_allocator.used_bytes == used,
+                      "Outer scope rewound to the objects before it");
+
+    // a mark taken in a rewound scope is refused
+    RegionMark stale = Region_mark(&region);
+    Region_rewind(&region, outer);
+    char* top = region.top;
+    Region_rewind(&region, stale);
+    print_test_result(region.top == top, "Mark after the top refused");
+    for (int i = 0; i < 100; i++) Region_malloc(&region, 200);
+    stale = Region_mark(&region);
+    Region_rewind(&region, outer);
+    Region_rewind(&region, stale);
+    print_test_result(region.top == top && count_chunks(&region) == 1, "Mark of a freed chunk refused");
+
+    // reset: the first chunk stays for the next request
+    RegionChunk* chunk = region.chunk;
+    for (int i = 0; i < 100; i++) Region_malloc(&region, 200);
+    Region_reset(&region);
+    print_test_result(region.chunk == chunk && region.top == (char*)chunk + 16 && buddy_allocator.used_bytes == used,
+                      "Reset keeps only the first chunk, empty");
+    Region_destroy(&region);
+    print_test_result(buddy_allocator.used_bytes == 0, "Region destroyed");
+
+    // a mark of the empty region frees everything
+    RegionMark empty = Region_mark(&region);
+    for (int i = 0; i < 100; i++) Region_malloc(&region, 200);
+    Region_rewind(&region, empty);
+    print_test_result(region.chunk == NULL && buddy_allocator.used_bytes == 0, "Rewind to an empty region frees all the chunks");
+
+    printf("== Mark and rewind tests completed ==\n");
+}
+
+void print_final_results() {
+    printf("\n========== TEST RESULTS ==========\n");
+    printf("Total tests run: %d\n", test_result.total_tests);
+    printf("Passed tests: %d\n", test_result.passed_tests);
+    printf("Failed tests: %d\n", test_result.total_tests - test_result.passed_tests);
+    printf("==================================\n");
+}
+
+int main(int argc, char** argv) {
+    printf("Initializing Buddy Allocator... ");
+    if (BuddyAllocator_init(&buddy_allocator, BUDDY_LEVELS, memory, MEMORY_SIZE, buffer, BUFFER_SIZE, MIN_BUCKET_SIZE) != 0) {
+        printf("Failed to initialize the buddy allocator\n");
+        return -1;
+    }
+    printf("DONE\n");
+
+    // Run tests
+    test_bump_allocation();
+    test_mark_rewind();
+
+    // Print final results
+    print_final_results();
+
+    return 0;
+}
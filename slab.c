@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include "slab.h"
+#include "log.h"
+#include "stats.h"
+
+// index of the smallest size class that holds size bytes
+static int size_class(size_t size){
+    if (size <= SLAB_MIN_CLASS) return 0;
+    return 32 - __builtin_clz(size - 1) - 3; // log2 of the next power of 2, minus log2(SLAB_MIN_CLASS)
+}
+
+// slab containing the object ptr: slabs are SLAB_SIZE blocks, aligned to
+// SLAB_SIZE from the start of the buddy memory
+static Slab* slab_of(SlabAllocator* slab_alloc, void* ptr){
+    size_t offset = (char*)ptr - slab_alloc->buddy->memory;
+    char* block = slab_alloc->buddy->memory + (offset & ~(size_t)(SLAB_SIZE - 1));
+    return (Slab*)(block + sizeof(BuddyHeader)); // after the buddy block header
+}
+
+static void list_remove(SlabAllocator* slab_alloc, int class, Slab* slab){
+    if (slab->prev) slab->prev->next = slab->next;
+    else slab_alloc->partial[class] = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = NULL;
+}
+
+static void list_push(SlabAllocator* slab_alloc, int class, Slab* slab){
+    slab->prev = NULL;
+    slab->next = slab_alloc->partial[class];
+    if (slab->next) slab->next->prev = slab;
+    slab_alloc->partial[class] = slab;
+}
+
+// takes a page from the buddy allocator and carves it into objects of a class
+static Slab* Slab_create(SlabAllocator* slab_alloc, int class){
+    BuddyAllocator* buddy = slab_alloc->buddy;
+    Slab* slab = BuddyAllocator_getBuddy(buddy, BuddyAllocator_level(buddy, SLAB_SIZE), SLAB_SIZE - sizeof(BuddyHeader));
+    if (!slab) return NULL;
+    char* block = (char*)slab - sizeof(BuddyHeader);
+
+    int object_size = SLAB_MIN_CLASS << class;
+    int max_objects = SLAB_SIZE / object_size;
+    uint8_t* bitmap_buffer = (uint8_t*)(slab + 1);
+    // objects are aligned to their size, up to 16 bytes
+    int align = object_size < 16 ? object_size : 16;
+    int header = (char*)(bitmap_buffer + BitMap_getBytes(max_objects)) - block;
+    header = (header + align - 1) & ~(align - 1);
+
+    slab->next = slab->prev = NULL;
+    slab->object_size = object_size;
+    slab->num_objects = (SLAB_SIZE - header) / object_size;
+    slab->used_objects = 0;
+    slab->objects = block + header;
+    BitMap_init(&slab->used, slab->num_objects, bitmap_buffer);
+    BitMap_setRange(&slab->used, 0, slab->num_objects, 0);
+    BitMap_setBit(&slab_alloc->slab_pages, (block - buddy->memory) / SLAB_SIZE, 1);
+    return slab;
+}
+
+int SlabAllocator_init(SlabAllocator* slab_alloc, BuddyAllocator* buddy){
+    // slabs are found by masking the offset of an object: a block must be exactly one slab
+    int level = BuddyAllocator_level(buddy, SLAB_SIZE);
+    if ((buddy->min_bucket_size << (buddy->num_levels - level)) != SLAB_SIZE){
+        LOG_ERROR("Error: the buddy allocator has no blocks of %d bytes for the slabs\n", SLAB_SIZE);
+        return -1;
+    }
+    slab_alloc->buddy = buddy;
+    for (int i = 0; i < SLAB_NUM_CLASSES; i++){
+        slab_alloc->partial[i] = NULL;
+    }
+    // the map of the slab pages is kept in a block of the buddy allocator itself
+    int num_pages = buddy->memory_size / SLAB_SIZE;
+    int map_size = BitMap_getBytes(num_pages);
+    uint8_t* map = BuddyAllocator_getBuddy(buddy, BuddyAllocator_level(buddy, map_size + sizeof(BuddyHeader)), map_size);
+    if (!map){
+        LOG_ERROR("Error: no memory for the slab page map\n");
+        return -1;
+    }
+    BitMap_init(&slab_alloc->slab_pages, num_pages, map);
+    BitMap_setRange(&slab_alloc->slab_pages, 0, num_pages, 0);
+    return 0;
+}
+
+void* SlabAllocator_malloc(SlabAllocator* slab_alloc, size_t size){
+    if (size == 0 || size > SLAB_MAX_CLASS){ // not a tiny allocation
+        return pseudo_malloc(slab_alloc->buddy, size);
+    }
+    int class = size_class(size);
+    Slab* slab = slab_alloc->partial[class];
+    if (!slab){
+        slab = Slab_create(slab_alloc, class);
+        if (!slab){
+            LOG_ERROR("Malloc error: no free memory block available for a slab\n");
+            Stats_failed();
+            return NULL;
+        }
+        list_push(slab_alloc, class, slab);
+    }
+    int idx = BitMap_findFirstZero(&slab->used, 0, slab->num_objects);
+    BitMap_setBit(&slab->used, idx, 1);
+    if (++slab->used_objects == slab->num_objects){ // full: no longer a candidate
+        list_remove(slab_alloc, class, slab);
+    }
+    return slab->objects + idx * slab->object_size;
+}
+
+void SlabAllocator_free(SlabAllocator* slab_alloc, void* ptr){
+    if (!ptr){
+        LOG_ERROR("\nFree error: Memory to be freed is NULL\n");
+        return;
+    }
+    BuddyAllocator* buddy = slab_alloc->buddy;
+    ptrdiff_t offset = (char*)ptr - buddy->memory;
+    if (offset < 0 || (size_t)offset >= buddy->memory_size || !BitMap_bit(&slab_alloc->slab_pages, offset / SLAB_SIZE)){
+        pseudo_free(buddy, ptr); // not in a slab: it has a header
+        return;
+    }
+    Slab* slab = slab_of(slab_alloc, ptr);
+    int idx = ((char*)ptr - slab->objects) / slab->object_size;
+    if (!BitMap_bit(&slab->used, idx)){
+        LOG_ERROR("\nFree error: Memory block at index: %p, already freed (double free).\n", ptr);
+        return;
+    }
+    BitMap_setBit(&slab->used, idx, 0);
+    int class = size_class(slab->object_size);
+    if (slab->used_objects-- == slab->num_objects){ // it was full: it has a free object again
+        list_push(slab_alloc, class, slab);
+    }
+    // an empty slab goes back to the buddy allocator, unless it is the only one of its class
+    if (slab->used_objects == 0 && (slab->prev || slab->next)){
+        list_remove(slab_alloc, class, slab);
+        BitMap_setBit(&slab_alloc->slab_pages, offset / SLAB_SIZE, 0);
+        BuddyAllocator_free(buddy, slab);
+    }
+}
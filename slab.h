@@ -0,0 +1,34 @@
+#pragma once
+#include "pseudo_malloc.h"
+
+#define SLAB_SIZE 4096        // bytes taken from the buddy allocator for each slab (one page)
+#define SLAB_MIN_CLASS 8      // size classes are the powers of 2 from 8 to 512 bytes
+#define SLAB_MAX_CLASS 512
+#define SLAB_NUM_CLASSES 7
+
+// a page of objects of the same size class, taken from the buddy allocator.
+// It starts after the buddy block header, the objects follow the bitmap
+typedef struct Slab {
+    struct Slab* next;  // list of the slabs of the class with free objects
+    struct Slab* prev;
+    int object_size;
+    int num_objects;
+    int used_objects;
+    char* objects;      // first object
+    BitMap used;        // a bit for each object, 1 if allocated
+} Slab;
+
+// Front end of pseudo_malloc for tiny allocations: requests up to SLAB_MAX_CLASS bytes
+// are served by headerless objects carved from slab pages, the others go to pseudo_malloc.
+typedef struct {
+    BuddyAllocator* buddy;
+    Slab* partial[SLAB_NUM_CLASSES]; // per class, slabs with at least a free object
+    BitMap slab_pages;               // a bit for each page of the buddy memory, 1 if it is a slab
+} SlabAllocator;
+
+// initializes the slab allocator on top of a buddy allocator, whose blocks
+// must be able to have exactly SLAB_SIZE bytes
+int SlabAllocator_init(SlabAllocator* slab_alloc, BuddyAllocator* buddy);
+
+void* SlabAllocator_malloc(SlabAllocator* slab_alloc, size_t size);
+void SlabAllocator_free(SlabAllocator* slab_alloc, void* ptr);
@@ -0,0 +1,116 @@
+#include "slab.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define BUFFER_SIZE 131072
+#define BUDDY_LEVELS 19
+#define MEMORY_SIZE (1024*1024)
+#define MIN_BUCKET_SIZE (MEMORY_SIZE >> BUDDY_LEVELS)
+#define NUM_OBJECTS 30000 // 16 byte objects: 480 KB of data, more than half of the memory with headers
+
+char buffer[BUFFER_SIZE];
+char memory[MEMORY_SIZE];
+
+BuddyAllocator buddy_allocator;
+SlabAllocator slab_allocator;
+
+typedef struct {
+    int total_tests;
+    int passed_tests;
+} TestResult;
+
+TestResult test_result = {0, 0};
+
+void print_test_result(bool passed, const char* description) {
+    test_result.total_tests++;
+    if (passed) {
+        test_result.passed_tests++;
+        printf("[SUCCESS] %s\n", description);
+    } else {
+        printf("[ERROR] %s\n", description);
+    }
+}
+
+void test_tiny_allocations() {
+    printf("\n== Running tiny allocation tests ==\n");
+
+    static void* objects[NUM_OBJECTS];
+    bool all_allocated = true, no_overlap = true;
+    for (int i = 0; i < NUM_OBJECTS; i++) {
+        objects[i] = SlabAllocator_malloc(&slab_allocator, 16);
+        if (!objects[i]) { all_allocated = false; break; }
+        memset(objects[i], i & 0xFF, 16);
+    }
+    for (int i = 0; i < NUM_OBJECTS && all_allocated; i++) {
+        for (int b = 0; b < 16; b++) {
+            if (((unsigned char*)objects[i])[b] != (i & 0xFF)) no_overlap = false;
+        }
+    }
+    print_test_result(all_allocated, "Allocate 30000 objects of 16 bytes (they would not fit with buddy headers)");
+    print_test_result(no_overlap, "Objects do not overlap");
+    print_test_result((char*)objects[1] - (char*)objects[0] == 16, "Objects of the same slab are contiguous (no header)");
+
+    // freed objects are reused
+    void* freed = objects[100];
+    SlabAllocator_free(&slab_allocator, freed);
+    objects[100] = SlabAllocator_malloc(&slab_allocator, 10);
+    print_test_result(objects[100] == freed, "A freed object is reused by its size class");
+
+    for (int i = 0; i < NUM_OBJECTS; i++) {
+        SlabAllocator_free(&slab_allocator, objects[i]);
+    }
+    void* p = BuddyAllocator_malloc(&buddy_allocator, MEMORY_SIZE / 2 - 16);
+    print_test_result(p != NULL, "Empty slabs given back to the buddy allocator");
+    BuddyAllocator_free(&buddy_allocator, p);
+
+    printf("== Tiny allocation tests completed ==\n");
+}
+
+void test_other_sizes() {
+    printf("\n== Running size class tests ==\n");
+
+    void* p1 = SlabAllocator_malloc(&slab_allocator, 1);
+    void* p2 = SlabAllocator_malloc(&slab_allocator, 512);
+    void* p3 = SlabAllocator_malloc(&slab_allocator, 513);   // Buddy Allocator
+    void* p4 = SlabAllocator_malloc(&slab_allocator, 5000);  // mmap
+    print_test_result(p1 && p2 && p3 && p4, "Allocate 1, 512, 513 and 5000 bytes");
+    print_test_result(((char*)p1 - memory) % 8 == 0 && ((char*)p2 - memory) % 16 == 0, "Slab objects are aligned");
+
+    SlabAllocator_free(&slab_allocator, p1);
+    SlabAllocator_free(&slab_allocator, p2);
+    SlabAllocator_free(&slab_allocator, p3);
+    SlabAllocator_free(&slab_allocator, p4);
+
+    void* p5 = SlabAllocator_malloc(&slab_allocator, 0);
+    print_test_result(p5 == NULL, "Correctly failed to allocate 0 bytes");
+
+    printf("== Size class tests completed ==\n");
+}
+
+void print_final_results() {
+    printf("\n========== TEST RESULTS ==========\n");
+    printf("Total tests run: %d\n", test_result.total_tests);
+    printf("Passed tests: %d\n", test_result.passed_tests);
+    printf("Failed tests: %d\n", test_result.total_tests - test_result.passed_tests);
+    printf("==================================\n");
+}
+
+int main(int argc, char** argv) {
+    printf("Initializing Buddy Allocator... ");
+    if (BuddyAllocator_init(&buddy_allocator, BUDDY_LEVELS, memory, MEMORY_SIZE, buffer, BUFFER_SIZE, MIN_BUCKET_SIZE) != 0 ||
+        SlabAllocator_init(&slab_allocator, &buddy_allocator) != 0) {
+        printf("Failed to initialize the allocators\n");
+        return -1;
+    }
+    printf("DONE\n");
+
+    // Run tests
+    test_tiny_allocations();
+    test_other_sizes();
+
+    // Print final results
+    print_final_results();
+
+    return 0;
+}
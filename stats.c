@@ -0,0 +1,68 @@
+#include "stats.h"
+
+static PseudoMallocStats counters;
+static uint64_t in_use; // buddy_bytes + mmap_bytes, for the peak
+
+#define ADD(counter, n) __atomic_add_fetch(&(counter), (n), __ATOMIC_RELAXED)
+#define READ(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+static void grow(int64_t bytes){
+    uint64_t total = ADD(in_use, bytes);
+    if (bytes <= 0) return;
+    uint64_t peak = READ(counters.peak_bytes);
+    while (total > peak && !__atomic_compare_exchange_n(&counters.peak_bytes, &peak, total, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void Stats_buddyAlloc(int level, size_t block_size, size_t size){
+    ADD(counters.level_allocs[level], 1);
+    ADD(counters.buddy_bytes, block_size);
+    ADD(counters.requested_bytes, size);
+    ADD(counters.block_bytes, block_size);
+    grow(block_size);
+}
+
+void Stats_buddyFree(int level, size_t block_size){
+    ADD(counters.level_frees[level], 1);
+    ADD(counters.buddy_bytes, -(int64_t)block_size);
+    grow(-(int64_t)block_size);
+}
+
+void Stats_buddyResize(long long delta){
+    ADD(counters.buddy_bytes, delta);
+    grow(delta);
+}
+
+void Stats_mmap(long long bytes){
+    ADD(counters.mmap_bytes, bytes);
+    grow(bytes);
+}
+
+void Stats_failed(void){
+    ADD(counters.failed_allocs, 1);
+}
+
+void Stats_purge(long long dirty, long long purged){
+    if (dirty) ADD(counters.dirty_bytes, dirty);
+    if (purged) ADD(counters.purged_bytes, purged);
+}
+
+void Stats_threshold(size_t bytes){
+    __atomic_store_n(&counters.threshold, bytes, __ATOMIC_RELAXED);
+}
+
+void pseudo_malloc_stats(PseudoMallocStats* stats){
+    for (int i = 0; i < MAX_LEVELS; i++){
+        stats->level_allocs[i] = READ(counters.level_allocs[i]);
+        stats->level_frees[i] = READ(counters.level_frees[i]);
+    }
+    stats->buddy_bytes = READ(counters.buddy_bytes);
+    stats->mmap_bytes = READ(counters.mmap_bytes);
+    stats->peak_bytes = READ(counters.peak_bytes);
+    stats->failed_allocs = READ(counters.failed_allocs);
+    stats->requested_bytes = READ(counters.requested_bytes);
+    stats->block_bytes = READ(counters.block_bytes);
+    stats->dirty_bytes = READ(counters.dirty_bytes);
+    stats->purged_bytes = READ(counters.purged_bytes);
+    stats->threshold = READ(counters.threshold);
+    stats->fragmentation = stats->block_bytes ? 1.0 - (double)stats->requested_bytes / stats->block_bytes : 0;
+}
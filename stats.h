@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+#include "buddy_allocator.h"
+
+// Counters of all the allocators of the process. They are updated with relaxed atomics:
+// each one is exact, but a snapshot taken while other threads allocate is not consistent
+// across fields
+typedef struct {
+    uint64_t level_allocs[MAX_LEVELS]; // buddy blocks taken, by level (0 is the whole memory of an allocator)
+    uint64_t level_frees[MAX_LEVELS];  // buddy blocks given back, by level
+    uint64_t buddy_bytes;      // bytes of the buddy blocks in use (cached by the threads and slabs included)
+    uint64_t mmap_bytes;       // bytes of the live mappings of the mmap path
+    uint64_t peak_bytes;       // maximum of buddy_bytes + mmap_bytes
+    uint64_t failed_allocs;    // allocations that found no memory
+    uint64_t requested_bytes;  // bytes requested to the buddy allocators so far
+    uint64_t block_bytes;      // bytes of the blocks given for them
+    double fragmentation;      // internal fragmentation estimate: 1 - requested_bytes / block_bytes
+    uint64_t dirty_bytes;      // pages of the free buddy blocks that may still be resident
+    uint64_t purged_bytes;     // pages of the free buddy blocks given back to the OS (BuddyAllocator_purge)
+    uint64_t threshold;        // current cutoff between the buddy allocators and mmap (pseudo_malloc_threshold)
+} PseudoMallocStats;
+
+// copies the counters in stats
+void pseudo_malloc_stats(PseudoMallocStats* stats);
+
+// updates of the counters, called by the allocators
+void Stats_buddyAlloc(int level, size_t block_size, size_t size);
+void Stats_buddyFree(int level, size_t block_size);
+void Stats_buddyResize(long long delta); // a block resized in place changes by delta bytes
+void Stats_mmap(long long bytes); // a mapping grows (bytes > 0) or shrinks
+void Stats_failed(void);
+void Stats_purge(long long dirty, long long purged); // free pages change state
+void Stats_threshold(size_t bytes);
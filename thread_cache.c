@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <pthread.h>
+#include "thread_cache.h"
+#include "log.h"
+#include "stats.h"
+
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER; // protects the shared allocator
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t exit_key; // to flush the cache when a thread exits
+
+static __thread ThreadCache cache;
+static __thread int cache_registered;
+
+static void thread_exit(void* arg){
+    (void)arg;
+    ThreadCache_flush();
+}
+
+static void create_key(void){
+    pthread_key_create(&exit_key, thread_exit);
+}
+
+// gives back the first n blocks cached for a level (lock held by the caller)
+static void flush_level(int level, int n){
+    for (int i = 0; i < n; i++){
+        BuddyAllocator_free(cache.alloc, cache.blocks[level][i]);
+    }
+    cache.count[level] -= n;
+    for (int i = 0; i < cache.count[level]; i++){ // keep the most recently freed blocks
+        cache.blocks[level][i] = cache.blocks[level][i + n];
+    }
+}
+
+// binds the cache of the calling thread to alloc, giving back the blocks of another allocator
+static void bind(BuddyAllocator* alloc){
+    if (!cache_registered){
+        pthread_once(&key_once, create_key);
+        pthread_setspecific(exit_key, &cache); // the value only has to be non NULL
+        cache_registered = 1;
+    }
+    if (cache.alloc != alloc){
+        ThreadCache_flush();
+        cache.alloc = alloc;
+    }
+}
+
+void* ThreadCache_malloc(BuddyAllocator* alloc, size_t size){
+    if (size == 0 || size >= pseudo_malloc_threshold()){ // errors and mmap allocations need no lock
+        return pseudo_malloc(NULL, size); // NULL: the threshold can move before pseudo_malloc reads it
+    }
+    size_t block_size = size + sizeof(BuddyHeader); // overhead (16 bytes)
+    if (block_size > alloc->memory_size){
+        LOG_ERROR("\nMalloc error: Requested memory larger than total available memory\n");
+        Stats_failed();
+        return NULL;
+    }
+    bind(alloc);
+    int level = BuddyAllocator_level(alloc, block_size);
+
+    if (cache.count[level] == 0){ // refill a batch from the shared allocator
+        pthread_mutex_lock(&shared_lock);
+        while (cache.count[level] < THREAD_CACHE_BATCH){
+            void* p = BuddyAllocator_getBuddy(alloc, level, size);
+            if (!p) break;
+            cache.blocks[level][cache.count[level]++] = p;
+        }
+        pthread_mutex_unlock(&shared_lock);
+        if (cache.count[level] == 0){
+            LOG_ERROR("Malloc error: no free memory block available\n");
+            Stats_failed();
+            return NULL;
+        }
+    }
+    void* p = cache.blocks[level][--cache.count[level]];
+    ((BuddyHeader*)p - 1)->size = size; // the block keeps its bitmap index, only the size changes
+    return p;
+}
+
+void ThreadCache_free(BuddyAllocator* alloc, void* ptr){
+    if (!ptr){
+        LOG_ERROR("\nFree error: Memory to be freed is NULL\n");
+        return;
+    }
+    if (pseudo_is_mapped(ptr)){ // mmap block
+        pseudo_free(alloc, ptr);
+        return;
+    }
+    bind(alloc);
+    int level = levelIdx(((BuddyHeader*)ptr - 1)->idx);
+    // an aligned block (pseudo_aligned_alloc) has its pointer past the start: it is too small
+    // for the requests of its level, and goes back to the allocator
+    if (BuddyAllocator_usableSize(alloc, ptr) != (alloc->memory_size >> level) - sizeof(BuddyHeader)){
+        pthread_mutex_lock(&shared_lock);
+        BuddyAllocator_free(alloc, ptr);
+        pthread_mutex_unlock(&shared_lock);
+        return;
+    }
+    if (cache.count[level] == THREAD_CACHE_SIZE){ // full: flush the oldest batch
+        pthread_mutex_lock(&shared_lock);
+        flush_level(level, THREAD_CACHE_BATCH);
+        pthread_mutex_unlock(&shared_lock);
+    }
+    cache.blocks[level][cache.count[level]++] = ptr;
+}
+
+void ThreadCache_flush(void){
+    if (!cache.alloc) return;
+    pthread_mutex_lock(&shared_lock);
+    for (int level = 0; level < MAX_LEVELS; level++){
+        flush_level(level, cache.count[level]);
+    }
+    pthread_mutex_unlock(&shared_lock);
+}
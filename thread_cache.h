@@ -0,0 +1,24 @@
+#pragma once
+#include "pseudo_malloc.h"
+
+#define THREAD_CACHE_SIZE 32  // max number of free blocks kept per level by each thread
+#define THREAD_CACHE_BATCH 16 // blocks moved at once between a thread cache and the shared allocator
+
+// Optional layer in front of pseudo_malloc for multithreaded programs.
+// Each thread keeps some free buddy blocks per level: small requests are served from
+// them without locking, the shared allocator is locked only to refill or flush a batch.
+// A shared allocator used through this layer must not be used directly at the same time.
+
+// free blocks cached by a thread, per level of the buddy allocator
+typedef struct {
+    BuddyAllocator* alloc; // allocator the cached blocks belong to
+    int count[MAX_LEVELS];
+    void* blocks[MAX_LEVELS][THREAD_CACHE_SIZE];
+} ThreadCache;
+
+void* ThreadCache_malloc(BuddyAllocator* alloc, size_t size);
+void ThreadCache_free(BuddyAllocator* alloc, void* ptr);
+
+// gives back to the shared allocator all the blocks cached by the calling thread
+// (done automatically when the thread exits)
+void ThreadCache_flush(void);
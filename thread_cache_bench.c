@@ -0,0 +1,112 @@
+#include "thread_cache.h"
+#include "concurrent_buddy.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+// Throughput of small malloc/free pairs from 1 to N threads, with a global mutex
+// around pseudo_malloc/pseudo_free, with the thread caches and with the lock-free
+// buddy allocator.
+// usage: ./thread_cache_bench [max_threads] [ops_per_thread]
+// (results go to stderr, run with > /dev/null to hide the allocator log)
+
+#define BUFFER_SIZE 131072
+#define BUDDY_LEVELS 19
+#define MEMORY_SIZE (1024*1024)
+#define MIN_BUCKET_SIZE (MEMORY_SIZE >> BUDDY_LEVELS)
+#define CONCURRENT_LEVELS 16 // the lock-free blocks keep their header: 16 bytes at least
+#define LIVE_BLOCKS 64 // blocks kept alive by each thread
+#define MAX_SIZE 256
+
+char buffer[BUFFER_SIZE];
+char memory[MEMORY_SIZE];
+char shared_memory[MEMORY_SIZE];
+uint8_t nodes[1 << (CONCURRENT_LEVELS + 1)];
+
+BuddyAllocator buddy_allocator;
+ConcurrentBuddy concurrent_buddy;
+pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int ops_per_thread = 100000;
+enum { MUTEX, CACHE, LOCK_FREE } mode;
+
+void* locked_malloc(int size) {
+    pthread_mutex_lock(&global_lock);
+    void* p = pseudo_malloc(&buddy_allocator, size);
+    pthread_mutex_unlock(&global_lock);
+    return p;
+}
+
+void locked_free(void* ptr) {
+    pthread_mutex_lock(&global_lock);
+    pseudo_free(&buddy_allocator, ptr);
+    pthread_mutex_unlock(&global_lock);
+}
+
+void* worker(void* arg) {
+    unsigned int seed = (unsigned int)(size_t)arg;
+    void* live[LIVE_BLOCKS] = {0};
+    for (int i = 0; i < ops_per_thread; i++) {
+        int slot = rand_r(&seed) % LIVE_BLOCKS;
+        int size = 1 + rand_r(&seed) % MAX_SIZE;
+        if (mode == CACHE) {
+            if (live[slot]) ThreadCache_free(&buddy_allocator, live[slot]);
+            live[slot] = ThreadCache_malloc(&buddy_allocator, size);
+        } else if (mode == LOCK_FREE) {
+            if (live[slot]) ConcurrentBuddy_free(&concurrent_buddy, live[slot]);
+            live[slot] = ConcurrentBuddy_malloc(&concurrent_buddy, size);
+        } else {
+            if (live[slot]) locked_free(live[slot]);
+            live[slot] = locked_malloc(size);
+        }
+    }
+    for (int slot = 0; slot < LIVE_BLOCKS; slot++) {
+        if (!live[slot]) continue;
+        if (mode == CACHE) ThreadCache_free(&buddy_allocator, live[slot]);
+        else if (mode == LOCK_FREE) ConcurrentBuddy_free(&concurrent_buddy, live[slot]);
+        else locked_free(live[slot]);
+    }
+    return NULL;
+}
+
+double run(int num_threads) {
+    pthread_t threads[num_threads];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < num_threads; i++) {
+        pthread_create(&threads[i], NULL, worker, (void*)(size_t)(i + 1));
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return (double)num_threads * ops_per_thread / seconds; // malloc/free pairs per second
+}
+
+int main(int argc, char** argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    if (argc > 2) ops_per_thread = atoi(argv[2]);
+    if (max_threads <= 0 || ops_per_thread <= 0) {
+        fprintf(stderr, "usage: %s [max_threads] [ops_per_thread]\n", argv[0]);
+        return -1;
+    }
+    if (BuddyAllocator_init(&buddy_allocator, BUDDY_LEVELS, memory, MEMORY_SIZE, buffer, BUFFER_SIZE, MIN_BUCKET_SIZE) != 0
+        || ConcurrentBuddy_init(&concurrent_buddy, CONCURRENT_LEVELS, shared_memory, MEMORY_SIZE, nodes, sizeof(nodes), MEMORY_SIZE >> CONCURRENT_LEVELS) != 0) {
+        fprintf(stderr, "Failed to initialize Buddy Allocator\n");
+        return -1;
+    }
+
+    fprintf(stderr, "%8s %18s %18s %8s %18s %8s\n", "threads", "mutex (ops/s)", "cache (ops/s)", "speedup", "lock-free (ops/s)", "speedup");
+    for (int n = 1; n <= max_threads; n++) {
+        mode = MUTEX;
+        double locked = run(n);
+        mode = CACHE;
+        double cached = run(n);
+        mode = LOCK_FREE;
+        double lock_free = run(n);
+        fprintf(stderr, "%8d %18.0f %18.0f %7.2fx %18.0f %7.2fx\n", n, locked, cached, cached / locked, lock_free, lock_free / locked);
+    }
+    return 0;
+}
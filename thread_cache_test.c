@@ -0,0 +1,136 @@
+#include "thread_cache.h"
+#include "pseudo_malloc.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#define BUFFER_SIZE 131072
+#define BUDDY_LEVELS 19
+#define MEMORY_SIZE (1024*1024)
+#define MIN_BUCKET_SIZE (MEMORY_SIZE >> BUDDY_LEVELS)
+#define NUM_THREADS 4
+#define ROUNDS 200
+#define BLOCKS_PER_ROUND 32
+
+char buffer[BUFFER_SIZE];
+char memory[MEMORY_SIZE];
+
+BuddyAllocator buddy_allocator;
+
+typedef struct {
+    int total_tests;
+    int passed_tests;
+} TestResult;
+
+TestResult test_result = {0, 0};
+
+void print_test_result(bool passed, const char* description) {
+    test_result.total_tests++;
+    if (passed) {
+        test_result.passed_tests++;
+        printf("[SUCCESS] %s\n", description);
+    } else {
+        printf("[ERROR] %s\n", description);
+    }
+}
+
+// each thread fills its blocks with its own pattern: an overlap between threads would corrupt it
+void* worker(void* arg) {
+    int id = (int)(size_t)arg;
+    long errors = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        void* blocks[BLOCKS_PER_ROUND];
+        int sizes[BLOCKS_PER_ROUND];
+        for (int i = 0; i < BLOCKS_PER_ROUND; i++) {
+            sizes[i] = 8 + (round * 7 + i * 13) % 500;
+            if (i % 8 == 7) sizes[i] += pseudo_malloc_threshold(); // some mmap allocations too
+            blocks[i] = ThreadCache_malloc(&buddy_allocator, sizes[i]);
+            if (!blocks[i]) { errors++; continue; }
+            memset(blocks[i], id, sizes[i]);
+        }
+        for (int i = 0; i < BLOCKS_PER_ROUND; i++) {
+            if (!blocks[i]) continue;
+            for (int b = 0; b < sizes[i]; b++) {
+                if (((unsigned char*)blocks[i])[b] != id) { errors++; break; }
+            }
+            ThreadCache_free(&buddy_allocator, blocks[i]);
+        }
+    }
+    return (void*)errors;
+}
+
+void test_concurrent_allocations() {
+    printf("\n== Running concurrent allocation tests ==\n");
+
+    pthread_t threads[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        pthread_create(&threads[i], NULL, worker, (void*)(size_t)(i + 1));
+    }
+    long errors = 0;
+    for (int i = 0; i < NUM_THREADS; i++) {
+        void* ret;
+        pthread_join(threads[i], &ret);
+        errors += (long)ret;
+    }
+    print_test_result(errors == 0, "Threads allocate and free through their caches without overlapping blocks");
+
+    // the caches of the exited threads have been flushed: the whole memory is free again
+    void* p = BuddyAllocator_malloc(&buddy_allocator, MEMORY_SIZE - 16);
+    print_test_result(p != NULL, "Whole memory available again after the threads exited");
+    BuddyAllocator_free(&buddy_allocator, p);
+
+    printf("== Concurrent allocation tests completed ==\n");
+}
+
+void test_cache_reuse() {
+    printf("\n== Running cache reuse tests ==\n");
+
+    void* p1 = ThreadCache_malloc(&buddy_allocator, 100);
+    print_test_result(p1 != NULL, "Allocate 100 bytes through the thread cache");
+    ThreadCache_free(&buddy_allocator, p1);
+    void* p2 = ThreadCache_malloc(&buddy_allocator, 90);
+    print_test_result(p2 == p1, "A freed block is reused from the cache for the same level");
+    ThreadCache_free(&buddy_allocator, p2);
+
+    // an aligned block starts past its header: it is not cached for the requests of its level
+    char* aligned = pseudo_aligned_alloc(&buddy_allocator, 256, 100);
+    ThreadCache_free(&buddy_allocator, aligned);
+    void* p3 = ThreadCache_malloc(&buddy_allocator, 400); // a block of 512 bytes, as the aligned one
+    print_test_result(aligned && p3 != aligned && BuddyAllocator_usableSize(&buddy_allocator, p3) >= 400,
+                      "Aligned block given back to the allocator, not reused from the cache");
+    ThreadCache_free(&buddy_allocator, p3);
+
+    ThreadCache_flush();
+    void* p = BuddyAllocator_malloc(&buddy_allocator, MEMORY_SIZE - 16);
+    print_test_result(p != NULL, "Whole memory available again after the flush");
+    BuddyAllocator_free(&buddy_allocator, p);
+
+    printf("== Cache reuse tests completed ==\n");
+}
+
+void print_final_results() {
+    printf("\n========== TEST RESULTS ==========\n");
+    printf("Total tests run: %d\n", test_result.total_tests);
+    printf("Passed tests: %d\n", test_result.passed_tests);
+    printf("Failed tests: %d\n", test_result.total_tests - test_result.passed_tests);
+    printf("==================================\n");
+}
+
+int main(int argc, char** argv) {
+    printf("Initializing Buddy Allocator... ");
+    if (BuddyAllocator_init(&buddy_allocator, BUDDY_LEVELS, memory, MEMORY_SIZE, buffer, BUFFER_SIZE, MIN_BUCKET_SIZE) != 0) {
+        printf("Failed to initialize Buddy Allocator\n");
+        return -1;
+    }
+    printf("DONE\n");
+
+    // Run tests
+    test_concurrent_allocations();
+    test_cache_reuse();
+
+    // Print final results
+    print_final_results();
+
+    return 0;
+}
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "trace.h"
+#include "log.h"
+
+// ring buffer of a thread: the thread is the only producer, the flushes take turns
+// through the flushing flag. A buffer is reused by a new thread once its owner exits
+typedef struct TraceBuffer {
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+    unsigned long head;        // next event to write to the file
+    unsigned long tail;        // next free position
+    int flushing;              // taken by the thread writing the buffer to the file
+    int in_use;                // owned by a thread
+    uint16_t thread;
+    uint64_t last_time;        // time of the last event, the times of a thread are increasing
+    struct TraceBuffer* next;  // list of all the buffers
+} TraceBuffer;
+
+int trace_enabled;
+static int trace_fd = -1;
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER; // the writes of a buffer are not interleaved
+static struct timespec trace_start;
+static TraceBuffer* buffers;  // pushed with a CAS, never removed
+static int num_threads;
+static __thread TraceBuffer* thread_buffer;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t exit_key; // to flush and give back the buffer of a thread when it exits
+
+// writes count events, resuming after short writes. On errors the event written in part is
+// cut from the file, so that the next ones stay aligned (write_lock held)
+static int Trace_write(const TraceEvent* events, unsigned long count){
+    const char* data = (const char*)events;
+    size_t bytes = count * sizeof(TraceEvent);
+    size_t written = 0;
+    while (written < bytes){
+        ssize_t n = write(trace_fd, data + written, bytes - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0){
+            size_t partial = written % sizeof(TraceEvent);
+            off_t end = partial ? lseek(trace_fd, 0, SEEK_END) : 0;
+            if (partial && (end < 0 || ftruncate(trace_fd, end - partial) != 0)){
+                LOG_ERROR("Trace error: cannot cut a partial event: %s\n", strerror(errno));
+            }
+            return -1;
+        }
+        written += n;
+    }
+    return 0;
+}
+
+// writes the events between head and tail: returns 0 if another thread is already doing it
+static int Trace_flush(TraceBuffer* buffer){
+    if (__atomic_exchange_n(&buffer->flushing, 1, __ATOMIC_ACQUIRE)) return 0;
+    unsigned long head = buffer->head;
+    unsigned long tail = __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE);
+    pthread_mutex_lock(&write_lock);
+    while (head < tail && trace_fd >= 0){
+        // up to the end of the events array, then from its start
+        unsigned long first = head % TRACE_BUFFER_EVENTS;
+        unsigned long count = tail - head;
+        if (first + count > TRACE_BUFFER_EVENTS) count = TRACE_BUFFER_EVENTS - first;
+        if (Trace_write(&buffer->events[first], count) != 0) break; // the events are dropped
+        head += count;
+    }
+    pthread_mutex_unlock(&write_lock);
+    __atomic_store_n(&buffer->head, tail, __ATOMIC_RELEASE);
+    __atomic_store_n(&buffer->flushing, 0, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static void thread_exit(void* arg){
+    TraceBuffer* buffer = arg;
+    Trace_flush(buffer);
+    thread_buffer = NULL;
+    __atomic_store_n(&buffer->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void create_key(void){
+    pthread_key_create(&exit_key, thread_exit);
+}
+
+// buffer of the calling thread: a buffer left by an exited thread, or a new one
+static TraceBuffer* Trace_buffer(void){
+    if (thread_buffer) return thread_buffer;
+    TraceBuffer* buffer;
+    for (buffer = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); buffer; buffer = buffer->next){
+        int unused = 0;
+        if (__atomic_compare_exchange_n(&buffer->in_use, &unused, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) break;
+    }
+    if (!buffer){
+        buffer = mmap(NULL, sizeof(TraceBuffer), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED) return NULL;
+        buffer->in_use = 1; // the rest is zero
+        buffer->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&buffers, &buffer->next, buffer, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+    buffer->thread = __atomic_add_fetch(&num_threads, 1, __ATOMIC_RELAXED);
+    buffer->last_time = 0;
+    pthread_once(&key_once, create_key);
+    pthread_setspecific(exit_key, buffer);
+    thread_buffer = buffer;
+    return buffer;
+}
+
+int Trace_start(const char* path){
+    if (trace_fd >= 0){
+        LOG_ERROR("Trace error: a trace is already running\n");
+        return -1;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0){
+        LOG_ERROR("Trace error: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    TraceHeader header = {TRACE_MAGIC, TRACE_VERSION, sizeof(TraceEvent)};
+    if (write(fd, &header, sizeof(header)) != sizeof(header)){
+        LOG_ERROR("Trace error: cannot write %s\n", path);
+        close(fd);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &trace_start);
+    // the times of a previous trace would push the events of the threads after the others
+    for (TraceBuffer* buffer = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); buffer; buffer = buffer->next){
+        buffer->last_time = 0;
+    }
+    trace_fd = fd;
+    __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void Trace_stop(void){
+    if (trace_fd < 0) return;
+    __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELEASE);
+    for (TraceBuffer* buffer = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); buffer; buffer = buffer->next){
+        while (!Trace_flush(buffer)) sched_yield();
+    }
+    close(trace_fd);
+    trace_fd = -1;
+}
+
+uint64_t Trace_time(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - trace_start.tv_sec) * 1000000000 + now.tv_nsec - trace_start.tv_nsec;
+}
+
+void Trace_event(TraceOp op, void* ptr, void* old_ptr, size_t size){
+    Trace_eventAt(op, ptr, old_ptr, size, Trace_time());
+}
+
+void Trace_eventAt(TraceOp op, void* ptr, void* old_ptr, size_t size, uint64_t time){
+    TraceBuffer* buffer = Trace_buffer();
+    if (!buffer) return;
+    // full: write it, or wait for the thread that is writing it
+    while (buffer->tail - __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE) == TRACE_BUFFER_EVENTS){
+        if (!Trace_flush(buffer)) sched_yield();
+    }
+    TraceEvent* event = &buffer->events[buffer->tail % TRACE_BUFFER_EVENTS];
+    if (time <= buffer->last_time) time = buffer->last_time + 1; // keeps the order of the thread after the sort
+    buffer->last_time = time;
+    event->time_ns = time;
+    event->id = (uintptr_t)ptr;
+    event->old_id = (uintptr_t)old_ptr;
+    event->size = size;
+    event->thread = buffer->thread;
+    event->op = op;
+    memset(event->pad, 0, sizeof(event->pad));
+    __atomic_store_n(&buffer->tail, buffer->tail + 1, __ATOMIC_RELEASE);
+}
+
+static int compare_time(const void* a, const void* b){
+    const TraceEvent* x = a;
+    const TraceEvent* y = b;
+    if (x->time_ns != y->time_ns) return x->time_ns < y->time_ns ? -1 : 1;
+    return (x->thread > y->thread) - (x->thread < y->thread);
+}
+
+long Trace_load(const char* path, TraceEvent** events){
+    FILE* f = fopen(path, "rb");
+    if (!f){
+        LOG_ERROR("Trace error: cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || header.magic != TRACE_MAGIC
+        || header.version != TRACE_VERSION || header.event_size != sizeof(TraceEvent)){
+        LOG_ERROR("Trace error: %s is not a trace of this version\n", path);
+        fclose(f);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long count = (ftell(f) - (long)sizeof(header)) / (long)sizeof(TraceEvent);
+    fseek(f, sizeof(header), SEEK_SET);
+    *events = malloc((count ? count : 1) * sizeof(TraceEvent));
+    if (!*events || (long)fread(*events, sizeof(TraceEvent), count, f) != count){
+        LOG_ERROR("Trace error: cannot read the events of %s\n", path);
+        free(*events);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    // the buffers of the threads are written in any order
+    qsort(*events, count, sizeof(TraceEvent), compare_time);
+    return count;
+}
+
+void Trace_lock(void){
+    pthread_mutex_lock(&write_lock);
+}
+
+void Trace_unlock(void){
+    pthread_mutex_unlock(&write_lock);
+}
+
+void Trace_forkChild(void){
+    for (TraceBuffer* buffer = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); buffer; buffer = buffer->next){
+        buffer->flushing = 0;
+    }
+    pthread_mutex_unlock(&write_lock);
+}
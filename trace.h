@@ -0,0 +1,70 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#define TRACE_MAGIC 0x45434152544d50ULL // "PMTRACE"
+#define TRACE_VERSION 2 // 2: 64-bit sizes
+#define TRACE_BUFFER_EVENTS 4096 // events buffered by each thread before a write to the file
+
+// Capture of the allocations of a program, to replay them offline (trace_replay).
+// Every thread records its events in its own ring buffer, without locks: the buffer is
+// written to the file when it is full, when the thread exits and at Trace_stop.
+// The recorder never calls malloc (the buffers are mmapped), so it can trace the
+// LD_PRELOAD library: PSEUDO_MALLOC_TRACE=file LD_PRELOAD=./libpseudomalloc.so program
+
+typedef enum {
+    TRACE_MALLOC = 1,  // id allocated with size bytes
+    TRACE_FREE = 2,    // id freed
+    TRACE_REALLOC = 3  // old_id resized to size bytes, now at id
+} TraceOp;
+
+// a record of the file. Objects are identified by their address: an id can be reused
+// once the object is freed
+typedef struct {
+    uint64_t time_ns; // since Trace_start
+    uint64_t id;
+    uint64_t old_id;  // realloc only
+    uint64_t size;
+    uint16_t thread;  // threads are numbered from 1 in order of their first event
+    uint8_t op;
+    uint8_t pad[5];
+} TraceEvent;
+
+// start of the file
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t event_size; // sizeof(TraceEvent)
+} TraceHeader;
+
+extern int trace_enabled; // set between Trace_start and Trace_stop
+
+// records an event if a trace is running (a single load otherwise)
+#define TRACE(op, ptr, old_ptr, size) \
+    do { if (__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED)) Trace_event(op, ptr, old_ptr, size); } while (0)
+
+// creates the trace file and starts recording, returns 0 on success
+int Trace_start(const char* path);
+
+// writes the buffered events of all the threads and closes the file. The other
+// threads should not be allocating any more
+void Trace_stop(void);
+
+void Trace_event(TraceOp op, void* ptr, void* old_ptr, size_t size);
+
+// time of the events (ns since Trace_start), and an event recorded at a time taken before:
+// a realloc is timed before its old block can be reused by another thread, which would record
+// its malloc before the realloc otherwise
+uint64_t Trace_time(void);
+void Trace_eventAt(TraceOp op, void* ptr, void* old_ptr, size_t size, uint64_t time);
+
+// take and release the lock of the file writes, to fork in a consistent state. In the child
+// Trace_forkChild releases it instead, and the buffers being written by the threads that did
+// not survive the fork can be written again
+void Trace_lock(void);
+void Trace_unlock(void);
+void Trace_forkChild(void);
+
+// reads a trace file in an array sorted by time (allocated with malloc, not for the
+// traced program): returns the number of events, -1 on errors
+long Trace_load(const char* path, TraceEvent** events);
@@ -0,0 +1,140 @@
+#include "pseudo_malloc.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+// Replays a trace recorded with PSEUDO_MALLOC_TRACE (trace.h) on pseudo_malloc/pseudo_free/
+// pseudo_realloc, in a single thread and as fast as possible, then reports the throughput,
+// the peak memory and the fragmentation.
+// usage: ./trace_replay trace_file [memory_mb]
+// (results go to stderr, run with > /dev/null to hide the allocator log)
+
+#define BUDDY_LEVELS 19 // buckets of 32 bytes with the default 16 MB
+
+// objects of the trace: the events refer to them by index instead of by address
+typedef struct {
+    uint64_t* ids;   // address of the live object in the traced program, 0 for empty, 1 for removed
+    long* objects;   // index of the object
+    long capacity;   // a power of 2
+} IdTable;
+
+static long id_find(IdTable* t, uint64_t id, int insert) {
+    long i = (id >> 4) * 0x9E3779B97F4A7C15ULL & (t->capacity - 1);
+    while (t->ids[i] != 0) {
+        if (t->ids[i] == id) return i;
+        i = (i + 1) & (t->capacity - 1);
+    }
+    return insert ? i : -1;
+}
+
+// replaces the addresses of the events with the object indexes (in id), and counts the
+// objects. Frees and reallocs of objects allocated before the trace start become TRACE_FREE
+// of nothing (id -1) and TRACE_MALLOC
+static long assign_objects(TraceEvent* events, long count, uint64_t* peak_live) {
+    IdTable t;
+    t.capacity = 1;
+    while (t.capacity < 2 * count + 2) t.capacity *= 2;
+    t.ids = calloc(t.capacity, sizeof(uint64_t));
+    t.objects = malloc(t.capacity * sizeof(long));
+    uint64_t* sizes = malloc((count + 1) * sizeof(uint64_t)); // of the objects
+    long num_objects = 0;
+    uint64_t live = 0;
+    *peak_live = 0;
+    for (long i = 0; i < count; i++) {
+        TraceEvent* e = &events[i];
+        long object = -1;
+        if (e->op == TRACE_FREE || (e->op == TRACE_REALLOC && e->old_id)) {
+            long slot = id_find(&t, e->old_id ? e->old_id : e->id, 0);
+            if (slot >= 0) {
+                object = t.objects[slot];
+                t.ids[slot] = 1; // removed: the probe sequences go on
+                live -= sizes[object];
+            }
+        }
+        if (e->op == TRACE_FREE) {
+            e->id = object;
+            continue;
+        }
+        if (object < 0) { // a new object, also for a realloc of an unknown one
+            object = num_objects++;
+            e->op = TRACE_MALLOC;
+        }
+        long slot = id_find(&t, e->id, 1);
+        t.ids[slot] = e->id;
+        t.objects[slot] = object;
+        sizes[object] = e->size;
+        live += e->size;
+        if (live > *peak_live) *peak_live = live;
+        e->id = object;
+    }
+    free(t.ids);
+    free(t.objects);
+    free(sizes);
+    return num_objects;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s trace_file [memory_mb]\n", argv[0]);
+        return -1;
+    }
+    size_t memory_size = (size_t)(argc > 2 ? atol(argv[2]) : 16) << 20;
+    TraceEvent* events;
+    long count = Trace_load(argv[1], &events);
+    if (count < 0) {
+        fprintf(stderr, "Cannot read the trace %s\n", argv[1]);
+        return -1;
+    }
+    uint64_t peak_live;
+    long num_objects = assign_objects(events, count, &peak_live);
+
+    BuddyAllocator alloc;
+    int bitmap_size = BitMap_getBytes((1 << (BUDDY_LEVELS + 1)) - 1);
+    char* memory = malloc(memory_size);
+    char* bitmap = malloc(bitmap_size);
+    if (memory_size == 0 || !memory || !bitmap
+        || BuddyAllocator_init(&alloc, BUDDY_LEVELS, memory, memory_size, bitmap, bitmap_size, memory_size >> BUDDY_LEVELS) != 0) {
+        fprintf(stderr, "Failed to initialize Buddy Allocator\n");
+        return -1;
+    }
+    void** objects = calloc(num_objects + 1, sizeof(void*));
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < count; i++) {
+        TraceEvent* e = &events[i];
+        switch (e->op) {
+        case TRACE_MALLOC:
+            objects[e->id] = pseudo_malloc(&alloc, e->size ? e->size : 1);
+            break;
+        case TRACE_FREE:
+            if ((long)e->id >= 0 && objects[e->id]) {
+                pseudo_free(&alloc, objects[e->id]);
+                objects[e->id] = NULL;
+            }
+            break;
+        case TRACE_REALLOC:
+            if (objects[e->id]) {
+                void* p = pseudo_realloc(&alloc, objects[e->id], e->size ? e->size : 1);
+                if (p) objects[e->id] = p; // the block is still there if realloc fails
+            }
+            break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    PseudoMallocStats stats;
+    pseudo_malloc_stats(&stats);
+    fprintf(stderr, "events:             %ld (%ld objects)\n", count, num_objects);
+    fprintf(stderr, "throughput:         %.0f events/s (%.1f ns/event)\n", count / seconds, seconds * 1e9 / (count ? count : 1));
+    fprintf(stderr, "peak live bytes:    %llu requested by the program\n", (unsigned long long)peak_live);
+    fprintf(stderr, "peak memory:        %llu bytes (buddy blocks and mappings)\n", (unsigned long long)stats.peak_bytes);
+    fprintf(stderr, "fragmentation:      %.3f (1 - peak live / peak memory)\n",
+            stats.peak_bytes ? 1 - (double)peak_live / stats.peak_bytes : 0);
+    fprintf(stderr, "internal frag.:     %.3f of the buddy blocks\n", stats.fragmentation);
+    fprintf(stderr, "failed allocations: %llu\n", (unsigned long long)stats.failed_allocs);
+    return 0;
+}
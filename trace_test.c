@@ -0,0 +1,208 @@
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/resource.h>
+
+#define TRACE_FILE "trace_test.trace"
+#define NUM_THREADS 4
+#define EVENTS_PER_THREAD (3 * TRACE_BUFFER_EVENTS) // the buffers are written while the threads run
+
+typedef struct {
+    int total_tests;
+    int passed_tests;
+} TestResult;
+
+TestResult test_result = {0, 0};
+
+void print_test_result(bool passed, const char* description) {
+    test_result.total_tests++;
+    if (passed) {
+        test_result.passed_tests++;
+        printf("[SUCCESS] %s\n", description);
+    } else {
+        printf("[ERROR] %s\n", description);
+    }
+}
+
+void test_single_thread() {
+    printf("\n== Running single thread trace tests ==\n");
+
+    print_test_result(Trace_start(TRACE_FILE) == 0, "Trace started");
+    print_test_result(Trace_start(TRACE_FILE) == -1, "Correctly failed to start a second trace");
+    char a, b;
+    Trace_event(TRACE_MALLOC, &a, NULL, 100);
+    Trace_event(TRACE_REALLOC, &b, &a, 5000);
+    Trace_event(TRACE_FREE, &b, NULL, 0);
+    Trace_event(TRACE_MALLOC, &a, NULL, 5UL << 30);
+    Trace_stop();
+
+    TraceEvent* events;
+    long count = Trace_load(TRACE_FILE, &events);
+    print_test_result(count == 4, "Four events read back");
+    if (count == 4) {
+        print_test_result(events[0].op == TRACE_MALLOC && events[0].id == (uintptr_t)&a && events[0].size == 100,
+                          "Malloc event with its object and size");
+        print_test_result(events[1].op == TRACE_REALLOC && events[1].id == (uintptr_t)&b && events[1].old_id == (uintptr_t)&a
+                          && events[1].size == 5000, "Realloc event with the old and new object");
+        print_test_result(events[2].op == TRACE_FREE && events[2].id == (uintptr_t)&b, "Free event");
+        print_test_result(events[0].time_ns < events[1].time_ns && events[1].time_ns < events[2].time_ns,
+                          "Increasing times");
+        print_test_result(events[0].thread == events[2].thread && events[0].thread != 0, "Same thread number");
+        print_test_result(events[3].size == 5UL << 30, "Size of 5 GB recorded without truncation");
+    }
+    free(events);
+
+    TRACE(TRACE_MALLOC, &a, NULL, 1); // not recorded after the stop
+    print_test_result(Trace_load(TRACE_FILE, &events) == 4, "No events recorded after Trace_stop");
+    free(events);
+
+    // the traces of version 1 had 32-bit sizes in events of 32 bytes
+    TraceHeader old = {TRACE_MAGIC, 1, 32};
+    FILE* f = fopen(TRACE_FILE, "w");
+    fwrite(&old, sizeof(old), 1, f);
+    fclose(f);
+    print_test_result(Trace_load(TRACE_FILE, &events) == -1, "Trace of an older version refused");
+
+    printf("== Single thread trace tests completed ==\n");
+}
+
+char short_objects[5];
+
+// its buffer is written at the exit, while the file can grow to 2 events and a half only
+void* short_writer(void* arg) {
+    for (int i = 0; i < 5; i++) Trace_event(TRACE_MALLOC, &short_objects[i], NULL, 100 + i);
+    return NULL;
+}
+
+void test_short_write() {
+    printf("\n== Running short write trace tests ==\n");
+
+    // the third event is written in part, then refused: the events after it must stay aligned
+    struct rlimit limit, saved;
+    getrlimit(RLIMIT_FSIZE, &saved);
+    limit = saved;
+    limit.rlim_cur = sizeof(TraceHeader) + 2 * sizeof(TraceEvent) + sizeof(TraceEvent) / 2;
+    signal(SIGXFSZ, SIG_IGN);
+    Trace_start(TRACE_FILE);
+    setrlimit(RLIMIT_FSIZE, &limit);
+    pthread_t thread;
+    pthread_create(&thread, NULL, short_writer, NULL);
+    pthread_join(thread, NULL);
+    setrlimit(RLIMIT_FSIZE, &saved);
+    signal(SIGXFSZ, SIG_DFL);
+    char a;
+    Trace_event(TRACE_MALLOC, &a, NULL, 200);
+    Trace_stop();
+
+    TraceEvent* events;
+    long count = Trace_load(TRACE_FILE, &events);
+    print_test_result(count == 3 && events[0].size == 100 && events[1].size == 101 && events[1].id == (uintptr_t)&short_objects[1]
+                      && events[2].size == 200 && events[2].id == (uintptr_t)&a,
+                      "Event written in part cut from the file, the next ones aligned");
+    if (count >= 0) free(events);
+
+    printf("== Short write trace tests completed ==\n");
+}
+
+void* thread_worker(void* arg) {
+    for (long i = 0; i < EVENTS_PER_THREAD; i++) {
+        TRACE(TRACE_MALLOC, (void*)(i + 1), NULL, (size_t)arg); // the size tells the thread
+    }
+    return NULL;
+}
+
+void test_threads() {
+    printf("\n== Running multithreaded trace tests ==\n");
+
+    Trace_start(TRACE_FILE);
+    pthread_t threads[NUM_THREADS];
+    for (long i = 0; i < NUM_THREADS; i++) {
+        pthread_create(&threads[i], NULL, thread_worker, (void*)i);
+    }
+    for (int i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    Trace_stop();
+
+    TraceEvent* events;
+    long count = Trace_load(TRACE_FILE, &events);
+    print_test_result(count == NUM_THREADS * EVENTS_PER_THREAD, "All the events of the threads written");
+
+    // in every thread, the objects must come in the order they were recorded
+    uint64_t last[NUM_THREADS] = {0};
+    int thread_of[NUM_THREADS] = {0};
+    bool ordered = true, sorted = true, one_number = true;
+    for (long i = 0; i < count; i++) {
+        int t = events[i].size;
+        ordered = ordered && t < NUM_THREADS && events[i].id == last[t] + 1;
+        if (t < NUM_THREADS) {
+            last[t] = events[i].id;
+            if (!thread_of[t]) thread_of[t] = events[i].thread;
+            one_number = one_number && thread_of[t] == events[i].thread;
+        }
+        sorted = sorted && (i == 0 || events[i - 1].time_ns <= events[i].time_ns);
+    }
+    print_test_result(ordered, "Events of each thread in their order");
+    print_test_result(sorted, "Events sorted by time");
+    print_test_result(one_number, "One thread number for each thread");
+    free(events);
+    unlink(TRACE_FILE);
+
+    printf("== Multithreaded trace tests completed ==\n");
+}
+
+char reused;
+
+// takes the block freed by the realloc of the main thread, and records its malloc
+void* reuser(void* arg) {
+    Trace_event(TRACE_MALLOC, &reused, NULL, 300);
+    return NULL;
+}
+
+void test_timed_event() {
+    printf("\n== Running timed event tests ==\n");
+
+    Trace_start(TRACE_FILE);
+    char moved;
+    uint64_t time = Trace_time(); // realloc of reused, which another thread allocates before it returns
+    pthread_t thread;
+    pthread_create(&thread, NULL, reuser, NULL);
+    pthread_join(thread, NULL);
+    Trace_eventAt(TRACE_REALLOC, &moved, &reused, 200, time);
+    Trace_stop();
+
+    TraceEvent* events;
+    long count = Trace_load(TRACE_FILE, &events);
+    print_test_result(count == 2 && events[0].op == TRACE_REALLOC && events[0].old_id == (uintptr_t)&reused
+                      && events[1].op == TRACE_MALLOC && events[1].id == (uintptr_t)&reused,
+                      "Realloc recorded at its start, before the malloc of its old block");
+    if (count >= 0) free(events);
+    unlink(TRACE_FILE);
+
+    printf("== Timed event tests completed ==\n");
+}
+
+void print_final_results() {
+    printf("\n========== TEST RESULTS ==========\n");
+    printf("Total tests run: %d\n", test_result.total_tests);
+    printf("Passed tests: %d\n", test_result.passed_tests);
+    printf("Failed tests: %d\n", test_result.total_tests - test_result.passed_tests);
+    printf("==================================\n");
+}
+
+int main(int argc, char** argv) {
+    // Run tests
+    test_single_thread();
+    test_short_write();
+    test_threads();
+    test_timed_event();
+
+    // Print final results
+    print_final_results();
+
+    return 0;
+}